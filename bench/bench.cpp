@@ -0,0 +1,530 @@
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <benchmark/benchmark.h>
+
+#include "thread/pipe_thread.h"
+#include "thread/mux_node.h"
+#include "thread/batch_node.h"
+#include "timer/timer_manager.h"
+
+using namespace duck::thread;
+using namespace duck::timer;
+
+
+//不同大小的负载，测试拷贝开销对缓冲的影响
+template<size_t N>
+struct Payload
+{
+    char data[N];
+};
+
+
+//偶数线程写，奇数线程读，Threads(2 * n)就是n对生产者/消费者。
+//写优先的环形缓冲不会阻塞写者，读者用非阻塞的try_get_sync，reads计数是真正读到新数据的次数。
+template<template<typename> class Buffer, size_t N>
+static void BM_RingBuffer(benchmark::State& state)
+{
+    static Buffer<Payload<N> >* buff = nullptr;
+    if (state.thread_index() == 0) {
+        buff = new Buffer<Payload<N> >(8, "bench");
+    }
+
+    Payload<N> value;
+    memset(&value, 0, sizeof(value));
+    ReadCursor cursor;
+    int64_t reads = 0;
+    bool producer = (state.thread_index() % 2 == 0);
+    for (auto _ : state) {
+        if (producer) {
+            buff->put(value);
+        } else if (buff->try_get_sync(cursor, &value)) {
+            reads++;
+        }
+        benchmark::DoNotOptimize(value);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * N);
+    state.counters["reads"] = benchmark::Counter(reads, benchmark::Counter::kIsRate);
+    state.counters["dropped"] = benchmark::Counter(cursor.dropped);
+    if (state.thread_index() == 0) {
+        delete buff;
+        buff = nullptr;
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_RingBuffer, RingBuffer, 64)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RingBuffer, RingBuffer, 4096)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RingBuffer, RingBuffer, 65536)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RingBuffer, LockFreeRingBuffer, 64)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RingBuffer, LockFreeRingBuffer, 4096)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RingBuffer, LockFreeRingBuffer, 65536)->ThreadRange(2, 32)->UseRealTime();
+
+
+//扇出：0号线程是唯一的写者，其余线程各自带游标读取，比较读者增加时写者的开销
+template<template<typename> class Buffer>
+static void BM_FanOut(benchmark::State& state)
+{
+    static Buffer<Payload<64> >* buff = nullptr;
+    if (state.thread_index() == 0) {
+        buff = new Buffer<Payload<64> >(8, "bench");
+    }
+
+    Payload<64> value;
+    memset(&value, 0, sizeof(value));
+    ReadCursor cursor;
+    int64_t reads = 0;
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            buff->put(value);
+        } else if (buff->try_get_sync(cursor, &value)) {
+            reads++;
+        }
+        benchmark::DoNotOptimize(value);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["reads"] = benchmark::Counter(reads, benchmark::Counter::kIsRate);
+    if (state.thread_index() == 0) {
+        delete buff;
+        buff = nullptr;
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_FanOut, RingBuffer)->Threads(2)->Threads(3)->Threads(5)->Threads(9)->Threads(17)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FanOut, LockFreeRingBuffer)->Threads(2)->Threads(3)->Threads(5)->Threads(9)->Threads(17)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FanOut, BroadcastRing)->Threads(2)->Threads(3)->Threads(5)->Threads(9)->Threads(17)->UseRealTime();
+
+
+//偶数线程push，奇数线程pop。每个线程的迭代次数相同，所以阻塞的push/pop最后一定能配平
+template<size_t N>
+static void BM_SafeQueue(benchmark::State& state)
+{
+    static SafeQueue<Payload<N> >* queue = nullptr;
+    if (state.thread_index() == 0) {
+        queue = new SafeQueue<Payload<N> >(1024, "bench");
+    }
+
+    Payload<N> value;
+    memset(&value, 0, sizeof(value));
+    bool producer = (state.thread_index() % 2 == 0);
+    for (auto _ : state) {
+        if (producer) {
+            queue->push(value);
+        } else {
+            value = queue->pop();
+        }
+        benchmark::DoNotOptimize(value);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * N);
+    if (state.thread_index() == 0) {
+        delete queue;
+        queue = nullptr;
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_SafeQueue, 64)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SafeQueue, 4096)->ThreadRange(2, 32)->UseRealTime();
+
+
+static void count_fire(std::atomic<int64_t>* fired)
+{
+    fired->fetch_add(1, std::memory_order_relaxed);
+}
+
+//提交N个长周期定时器，直到全部挂到引擎上，测试插入速率
+static void BM_TimerSubmit(benchmark::State& state)
+{
+    int64_t num = state.range(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::atomic<int64_t> fired(0);
+        std::unique_ptr<TimerManager> manager(new TimerManager(1, state.range(1)));
+        std::vector<TimerHandle> handles;
+        handles.reserve(num);
+        manager->start();
+        state.ResumeTiming();
+
+        for (int64_t i = 0; i < num; i++) {
+            handles.push_back(manager->submit_us(10000000, -1, 0, count_fire, &fired));
+        }
+        while((int64_t)manager->size() < num) {
+            std::this_thread::yield();
+        }
+
+        state.PauseTiming();
+        manager.reset();
+        handles.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * num);
+}
+
+//提交N个只触发一次的定时器，直到全部回调执行完，测试插入+触发+移除的速率
+static void BM_TimerFire(benchmark::State& state)
+{
+    int64_t num = state.range(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::atomic<int64_t> fired(0);
+        std::unique_ptr<TimerManager> manager(new TimerManager(1, state.range(1)));
+        manager->start();
+        state.ResumeTiming();
+
+        for (int64_t i = 0; i < num; i++) {
+            manager->submit_us(1000, 1, 0, count_fire, &fired);
+        }
+        while(fired.load(std::memory_order_relaxed) < num) {
+            std::this_thread::yield();
+        }
+
+        state.PauseTiming();
+        manager.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * num);
+}
+
+BENCHMARK(BM_TimerSubmit)->ArgsProduct({{10000, 100000, 1000000}, {TIMER_ENGINE_MAP, TIMER_ENGINE_WHEEL}})
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_TimerFire)->ArgsProduct({{10000, 100000, 1000000}, {TIMER_ENGINE_MAP, TIMER_ENGINE_WHEEL}})
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+//合成流水线的源节点，period_us <= 0时不限速，尽可能快地产生数据
+class BenchSource : public RootNode
+{
+public:
+    BenchSource(const std::string& node_name, long period_us) : RootNode(node_name), period_us_(period_us) {}
+
+    void compute(PipeData& pipe_data) {
+        if (period_us_ <= 0) {
+            return;
+        }
+        if (next_ == std::chrono::steady_clock::time_point()) {
+            next_ = std::chrono::steady_clock::now();
+        }
+        next_ += std::chrono::microseconds(period_us_);
+        std::this_thread::sleep_until(next_);
+        //限速的sleep不算采集，端到端延迟从醒来时算起
+        pipe_data.set_capture_ns(PipeStamp::now_ns());
+    }
+
+protected:
+    long period_us_;
+    std::chrono::steady_clock::time_point next_;
+};
+
+//空的中间节点，只测量转发开销
+class BenchHop : public FilterNode
+{
+public:
+    BenchHop(const std::string& node_name) : FilterNode(node_name) {}
+
+    void compute(PipeData& pipe_data) {}
+};
+
+static void run_pipeline(benchmark::State& state, BenchSource& source, std::vector<std::unique_ptr<BenchHop> >& leaves, int hops)
+{
+    const int64_t window_ms = 1000;
+    source.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(window_ms));
+    source.stop();
+
+    NodeMetricsSnapshot root;
+    source.collect_metrics(root);
+    uint64_t frames = 0;
+    HistogramSnapshot e2e;
+    HistogramSnapshot queue;
+    for (auto& leaf : leaves) {
+        NodeMetricsSnapshot snapshot;
+        leaf->collect_metrics(snapshot);
+        frames += snapshot.frames_in;
+        if (snapshot.e2e_ns.percentile(0.99) >= e2e.percentile(0.99)) {
+            e2e = snapshot.e2e_ns;
+            queue = snapshot.queue_ns;
+        }
+    }
+
+    double seconds = window_ms / 1000.0;
+    state.counters["source_fps"] = root.frames_out / seconds;
+    state.counters["leaf_fps"] = frames / seconds / leaves.size();
+    state.counters["e2e_p50_us"] = e2e.percentile(0.5) / 1000.0;
+    state.counters["e2e_p99_us"] = e2e.percentile(0.99) / 1000.0;
+    state.counters["hop_p50_us"] = state.counters["e2e_p50_us"] / hops;
+    state.counters["hop_queue_p99_us"] = queue.percentile(0.99) / 1000.0;
+}
+
+//一条直线的流水线，range(0)是中间节点数，range(1)是源节点的帧率(0为不限速)
+static void BM_PipelineChain(benchmark::State& state)
+{
+    int depth = state.range(0);
+    long period_us = (state.range(1) > 0) ? (1000000 / state.range(1)) : 0;
+    for (auto _ : state) {
+        BenchSource source("bench_source", period_us);
+        std::vector<std::unique_ptr<BenchHop> > hops;
+        PipeNode* tail = &source;
+        for (int i = 0; i < depth; i++) {
+            hops.emplace_back(new BenchHop("bench_hop" + std::to_string(i)));
+            tail = tail->append(hops.back().get());
+        }
+
+        std::vector<std::unique_ptr<BenchHop> > leaves;
+        leaves.push_back(std::move(hops.back()));
+        run_pipeline(state, source, leaves, depth);
+    }
+}
+
+//一个源节点扇出到range(0)个叶子节点
+static void BM_PipelineFanout(benchmark::State& state)
+{
+    int width = state.range(0);
+    long period_us = (state.range(1) > 0) ? (1000000 / state.range(1)) : 0;
+    for (auto _ : state) {
+        BenchSource source("bench_source", period_us);
+        std::vector<std::unique_ptr<BenchHop> > leaves;
+        for (int i = 0; i < width; i++) {
+            leaves.emplace_back(new BenchHop("bench_leaf" + std::to_string(i)));
+            source.append(leaves.back().get());
+        }
+        run_pipeline(state, source, leaves, 1);
+    }
+}
+
+//range(0)路源经过MuxNode共享一个处理节点，range(1)是每一路的帧率(0为不限速)。
+//处理线程数不随路数增加，stream_min/max_fps看各路之间是否公平
+static void BM_PipelineMux(benchmark::State& state)
+{
+    int streams = state.range(0);
+    long period_us = (state.range(1) > 0) ? (1000000 / state.range(1)) : 0;
+    const int64_t window_ms = 1000;
+    for (auto _ : state) {
+        std::vector<std::unique_ptr<BenchSource> > sources;
+        for (int i = 0; i < streams; i++) {
+            sources.emplace_back(new BenchSource("bench_stream" + std::to_string(i), period_us));
+        }
+        MuxNode mux("bench_mux");
+        BenchHop leaf("bench_mux_leaf");
+        mux.append(&leaf, EDGE_LOSSLESS, 64);
+        for (auto& source : sources) {
+            mux.add_stream(source.get());
+        }
+
+        mux.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(window_ms));
+        //停止时各路依次排空，只统计窗口内的帧数
+        NodeMetricsSnapshot snapshot;
+        leaf.collect_metrics(snapshot);
+        uint64_t min_frames = UINT64_MAX;
+        uint64_t max_frames = 0;
+        for (int i = 0; i < streams; i++) {
+            min_frames = std::min(min_frames, mux.stream_frames(i));
+            max_frames = std::max(max_frames, mux.stream_frames(i));
+        }
+        mux.stop();
+
+        double seconds = window_ms / 1000.0;
+        state.counters["leaf_fps"] = snapshot.frames_in / seconds;
+        state.counters["stream_min_fps"] = min_frames / seconds;
+        state.counters["stream_max_fps"] = max_frames / seconds;
+        state.counters["e2e_p99_us"] = snapshot.e2e_ns.percentile(0.99) / 1000.0;
+    }
+}
+
+//模拟批量推理：每批固定开销500us，每帧再加100us
+class BenchBatch : public BatchNode
+{
+public:
+    BenchBatch(const std::string& node_name, size_t max_batch, long max_wait_us) : BatchNode(node_name, 4, max_batch, max_wait_us) {}
+
+    void compute_batch(std::vector<PipeData>& batch) {
+        std::this_thread::sleep_for(std::chrono::microseconds(500 + 100 * batch.size()));
+    }
+};
+
+//8路1000fps的源经过MuxNode进入一个批处理节点，range(0)是max_batch，range(1)是max_wait_us。
+//max_batch为1时就是逐帧处理，看攒批换来的吞吐和付出的延迟
+static void BM_PipelineBatch(benchmark::State& state)
+{
+    const int streams = 8;
+    const int64_t window_ms = 1000;
+    for (auto _ : state) {
+        std::vector<std::unique_ptr<BenchSource> > sources;
+        for (int i = 0; i < streams; i++) {
+            sources.emplace_back(new BenchSource("bench_batch_stream" + std::to_string(i), 1000));
+        }
+        MuxNode mux("bench_batch_mux");
+        BenchBatch batch("bench_batch", state.range(0), state.range(1));
+        BenchHop leaf("bench_batch_leaf");
+        mux.append(&batch, EDGE_DROP_OLDEST, 64)->append(&leaf, EDGE_LOSSLESS, 64);
+        for (auto& source : sources) {
+            mux.add_stream(source.get());
+        }
+
+        mux.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(window_ms));
+        NodeMetricsSnapshot leaf_snapshot;
+        leaf.collect_metrics(leaf_snapshot);
+        NodeMetricsSnapshot batch_snapshot;
+        batch.collect_metrics(batch_snapshot);
+        mux.stop();
+
+        double seconds = window_ms / 1000.0;
+        state.counters["leaf_fps"] = leaf_snapshot.frames_in / seconds;
+        state.counters["batch_mean"] = batch_snapshot.batch_size.mean();
+        state.counters["batch_wait_p99_us"] = batch_snapshot.batch_wait_ns.percentile(0.99) / 1000.0;
+        state.counters["e2e_p99_us"] = leaf_snapshot.e2e_ns.percentile(0.99) / 1000.0;
+    }
+}
+
+//模拟一个比源节点周期慢的阶段：每帧2ms
+class BenchSlow : public FilterNode
+{
+public:
+    BenchSlow(const std::string& node_name) : FilterNode(node_name) {}
+
+    void compute(PipeData& pipe_data) {
+        std::this_thread::sleep_for(std::chrono::microseconds(2000));
+    }
+};
+
+//1000fps的源经过2ms的慢节点，range(0)是副本数，range(1)是分发方式，看吞吐随副本数的变化和重排带来的延迟
+static void BM_PipelineReplica(benchmark::State& state)
+{
+    const int64_t window_ms = 1000;
+    for (auto _ : state) {
+        BenchSource source("bench_replica_source", 1000);
+        BenchSlow slow("bench_replica");
+        BenchHop leaf("bench_replica_leaf");
+        slow.set_replicas(state.range(0), state.range(1), 0, 50000);
+        source.append(&slow, EDGE_DROP_OLDEST, 16)->append(&leaf, EDGE_LOSSLESS, 64);
+
+        source.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(window_ms));
+        NodeMetricsSnapshot snapshot;
+        leaf.collect_metrics(snapshot);
+        uint64_t skipped = slow.replica_skipped_count();
+        source.stop();
+
+        double seconds = window_ms / 1000.0;
+        state.counters["leaf_fps"] = snapshot.frames_in / seconds;
+        state.counters["skipped"] = skipped;
+        state.counters["e2e_p99_us"] = snapshot.e2e_ns.percentile(0.99) / 1000.0;
+    }
+}
+
+//第一帧卡住500ms(模拟网络中断)，之后每帧100us
+class BenchStall : public FilterNode
+{
+public:
+    BenchStall(const std::string& node_name) : FilterNode(node_name), frames_(0) {}
+
+    void compute(PipeData& pipe_data) {
+        long us = (frames_.fetch_add(1) == 0) ? 500000 : 100;
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    int64_t frames() {
+        return frames_.load();
+    }
+
+protected:
+    std::atomic<int64_t> frames_;
+};
+
+//1000fps的源带20ms的延迟预算，一次卡顿把compute()的耗时估计拉到预算以上。
+//卡顿过去之后估计要能降下来继续处理，不能从此把所有帧都当成来不及丢掉
+static void BM_PipelineDeadlineRecovery(benchmark::State& state)
+{
+    const int64_t window_ms = 1000;
+    for (auto _ : state) {
+        BenchSource source("bench_stall_source", 1000);
+        BenchStall stall("bench_stall");
+        BenchHop leaf("bench_stall_leaf");
+        source.set_latency_budget_us(20000);
+        source.append(&stall, EDGE_DROP_OLDEST, 16)->append(&leaf, EDGE_LOSSLESS, 64);
+
+        source.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(window_ms));
+        int64_t recovered = stall.frames() - 1;
+        uint64_t missed = stall.deadline_missed_count();
+        source.stop();
+
+        state.counters["frames_after_stall"] = recovered;
+        state.counters["deadline_missed"] = missed;
+        if (recovered <= 0) {
+            state.SkipWithError("compute estimate never recovered after the stall");
+        }
+    }
+}
+
+//上游卡在compute()里时单独停一个分支，分支等不到新的输入，排空超时后要被唤醒退出，
+//stop()不能一直等到上游恢复
+static void BM_PipelineStopStalled(benchmark::State& state)
+{
+    const int64_t drain_ms = 100;
+    for (auto _ : state) {
+        BenchSource source("bench_block_source", 1000);
+        BenchStall stall("bench_block");
+        BenchHop leaf("bench_block_leaf");
+        source.append(&stall, EDGE_DROP_OLDEST, 16)->append(&leaf, state.range(0), 16);
+
+        source.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        int64_t begin_ns = PipeStamp::now_ns();
+        bool drained = leaf.stop(drain_ms);
+        int64_t stop_ms = (PipeStamp::now_ns() - begin_ns) / 1000000;
+        source.stop();
+
+        state.counters["stop_ms"] = stop_ms;
+        state.counters["drained"] = drained;
+        if (stop_ms > 2 * drain_ms) {
+            state.SkipWithError("stop() waited for the stalled upstream");
+        }
+    }
+}
+
+BENCHMARK(BM_PipelineChain)->ArgsProduct({{1, 4, 8, 16}, {0, 30, 1000}})->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_PipelineFanout)->ArgsProduct({{2, 8, 16}, {0, 1000}})->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_PipelineMux)->ArgsProduct({{4, 16, 32}, {0, 30, 1000}})->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_PipelineBatch)->ArgsProduct({{1, 4, 16}, {1000, 5000}})->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_PipelineReplica)->ArgsProduct({{1, 2, 4, 8}, {REPLICA_ROUND_ROBIN, REPLICA_LEAST_LOADED}})->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_PipelineDeadlineRecovery)->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_PipelineStopStalled)->Arg(EDGE_SHARED)->Arg(EDGE_DROP_OLDEST)->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+//默认输出JSON，方便在升级时比较吞吐和p99，命令行指定了--benchmark_format时以命令行为准
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_minloglevel = 1;
+
+    std::vector<char*> args(argv, argv + argc);
+    std::string json_format = "--benchmark_format=json";
+    bool has_format = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--benchmark_format", 18) == 0) {
+            has_format = true;
+        }
+    }
+    if (!has_format) {
+        args.push_back(&json_format[0]);
+    }
+
+    int bench_argc = args.size();
+    benchmark::Initialize(&bench_argc, args.data());
+    if (benchmark::ReportUnrecognizedArguments(bench_argc, args.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
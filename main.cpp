@@ -1,6 +1,9 @@
 #include "thread/pipe_thread.h"
 #include "pipe/user_node.h"
 #include "timer/timer_manager.h"
+#include "thread/metrics_exporter.h"
+#include "thread/pipe_graph.h"
+#include "thread/rate_controller.h"
 
 using namespace duck::pipe;
 using namespace duck::thread;
@@ -12,58 +15,181 @@ void stats_fps(BenchMarkNode* node)
     LOG(WARNING) << node->name() << " fps=" << fps; 
 }
 
+void stats_pace(FilterNode* node)
+{
+    LOG(WARNING) << node->name() << " jitter=" << node->jitter_us() << "us max=" << node->max_jitter_us() 
+        << "us missed=" << node->missed_deadline_count();
+}
+
+//每个节点的计数和各阶段的p50/p99/p999，单位微秒
+void stats_latency()
+{
+    std::vector<NodeMetricsSnapshot> snapshots = MetricsRegistry::instance().snapshot();
+    for (auto& snapshot : snapshots) {
+        LOG(WARNING) << snapshot.name << " in=" << snapshot.frames_in << " out=" << snapshot.frames_out
+            << " dropped=" << snapshot.dropped << " overwritten=" << snapshot.overwritten
+            << " compute=" << snapshot.compute_ns.percentile(0.5) / 1000 << "/" << snapshot.compute_ns.percentile(0.99) / 1000 << "/" << snapshot.compute_ns.percentile(0.999) / 1000
+            << " queue=" << snapshot.queue_ns.percentile(0.5) / 1000 << "/" << snapshot.queue_ns.percentile(0.99) / 1000 << "/" << snapshot.queue_ns.percentile(0.999) / 1000
+            << " e2e=" << snapshot.e2e_ns.percentile(0.5) / 1000 << "/" << snapshot.e2e_ns.percentile(0.99) / 1000 << "/" << snapshot.e2e_ns.percentile(0.999) / 1000
+            << " late=" << snapshot.deadline_missed;
+        if (snapshot.batch_size.count > 0) {
+            LOG(WARNING) << snapshot.name << " batch=" << snapshot.batch_size.mean() << "/" << snapshot.batch_size.max
+                << " wait=" << snapshot.batch_wait_ns.percentile(0.5) / 1000 << "/" << snapshot.batch_wait_ns.percentile(0.99) / 1000;
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
     google::InstallFailureSignalHandler();
     google::InitGoogleLogging(argv[0]);
 
-    if (argc != 2) {
-        printf("usage: %s (0:INFO, 1:WARNING, 2:ERROR, 3:FATAL)\n", argv[0]);
+    if (argc < 2) {
+        printf("usage: %s (0:INFO, 1:WARNING, 2:ERROR, 3:FATAL) [0:thread per node, 1:executor] [metrics address, unix:/path or host:port] [trace json path] [pipeline json]\n"
+            "  use - to skip an optional argument\n", argv[0]);
         return -1;
     }
 
     FLAGS_stderrthreshold = atoi(argv[1]);
     FLAGS_minloglevel = 0;
 
-    TimerManager manager(1);
- 
-    CaptureNode node_cap("node_cap");
-    PreProcNode node_pre_proc("node_pre_proc");
-    DetectNode node_detect("node_detect"); 
- 
-    VoPreNode node_vo_pre("node_vo_pre", 4, 33333);
-    VoNode node_vo("node_vo");
-    BenchMarkNode node_bench_vo("node_bench_vo");
-
-
-    VencNode node_venc("node_venc"); 
+    TimerManager manager(1, TIMER_ENGINE_WHEEL);
+    //示例节点用sleep模拟计算，会占住worker，所以这里worker数比核数多
+    Executor executor(8);
+    bool use_executor = (argc > 2) && (atoi(argv[2]) == 1);
+    std::unique_ptr<MetricsExporter> exporter;
+    if ((argc > 3) && (std::string(argv[3]) != "-")) {
+        exporter.reset(new MetricsExporter(argv[3]));
+    }
+    std::string trace_path = ((argc > 4) && (std::string(argv[4]) != "-")) ? argv[4] : "";
  
-    RecordNode node_record("node_record", 4, 50000);
-    BenchMarkNode node_bench_record("node_bench_record");
+    //给了配置文件时按配置搭建拓扑，调缓冲深度和帧率不用重新编译；否则用下面写死的拓扑
+    PipeGraph graph;
+    if (argc > 5) {
+        register_user_nodes();
+        if (!graph.load_file(argv[5])) {
+            std::cout << "load " << argv[5] << " failed: " << graph.error() << std::endl;
+            return -1;
+        }
+    } else {
+        CaptureNode* node_cap = graph.adopt(new CaptureNode("node_cap"));
+        PreProcNode* node_pre_proc = graph.adopt(new PreProcNode("node_pre_proc"));
+        DetectNode* node_detect = graph.adopt(new DetectNode("node_detect")); 
  
-    RtspNode node_rtsp("node_rtsp", 4, 40000);
-    BenchMarkNode node_bench_rtsp("node_bench_rtsp");
-
-    node_cap.append(&node_pre_proc)->append(&node_detect)->append(&node_vo_pre)->append(&node_vo)->append(&node_bench_vo);
- 
-    node_detect.append(&node_venc)->append(&node_record);//->append(&node_bench_record);
+        VoPreNode* node_vo_pre = graph.adopt(new VoPreNode("node_vo_pre", 4, 33333));
+        node_vo_pre->set_spin_us(200);
+        VoNode* node_vo = graph.adopt(new VoNode("node_vo"));
+        BenchMarkNode* node_bench_vo = graph.adopt(new BenchMarkNode("node_bench_vo"));
+
+        VencNode* node_venc = graph.adopt(new VencNode("node_venc")); 
+        RecordNode* node_record = graph.adopt(new RecordNode("node_record", 4, 50000));
+        RtspNode* node_rtsp = graph.adopt(new RtspNode("node_rtsp", 4, 40000));
+
+        //640x480 NV12，块数要覆盖所有节点的缓冲深度
+        node_cap->set_pool(640 * 480 * 3 / 2, 64);
+        //采集后300ms还没送到的帧对预览和推流已经没有意义，录像不能丢帧，不看截止时间
+        node_cap->set_latency_budget_us(300000);
+        node_record->set_deadline_policy(DEADLINE_IGNORE);
+
+        node_detect->set_buff_type(PIPE_BUFF_BROADCAST);
+        node_venc->set_buff_type(PIPE_BUFF_LOCKFREE);
+        //编码25ms比采集周期长，开两个副本并行编码，输出仍按帧序
+        node_venc->set_replicas(2, REPLICA_ROUND_ROBIN, 4, 100000);
+
+        //预览走低延迟的latest_only，录像不能丢帧，用有界FIFO对编码做背压
+        node_cap->append(node_pre_proc)->append(node_detect)->append(node_vo_pre, EDGE_LATEST_ONLY)->append(node_vo)->append(node_bench_vo);
+        node_detect->append(node_venc)->append(node_record, EDGE_LOSSLESS, 8);
+        node_venc->append(node_rtsp);
+
+        //采集和显示是延迟敏感的，绑到固定的核上，避免被迁移或被录像抢占
+        SchedPolicy rt_policy;
+        rt_policy.cpus.push_back(0);
+        node_cap->set_sched_policy(rt_policy);
+        node_vo->set_sched_policy(rt_policy);
+    }
+    RootNode* root = graph.root();
+    PipeNode* venc = graph.node("node_venc");
+    //运行中临时接入的拉流客户端，持有根节点缓冲池里的帧，要在graph之前析构
+    RtspNode node_viewer("node_rtsp_viewer", 4);
 
-    node_venc.append(&node_rtsp);//->append(&node_bench_rtsp);
+    if (use_executor) {
+        root->set_executor(&executor, &manager);
+    }
+    manager.set_executor(&executor);
+    executor.start();
+
+    //统计回调投递到线程池执行，不会拖慢帧节拍的定时器
+    std::vector<TimerHandle> stats_timers;
+    for (auto node : graph.nodes()) {
+        BenchMarkNode* bench = dynamic_cast<BenchMarkNode*>(node);
+        FilterNode* filter = dynamic_cast<FilterNode*>(node);
+        if (bench) {
+            stats_timers.push_back(manager.submit_us(1000000, -1, TIMER_DISPATCH, stats_fps, bench));
+        } else if (filter && (filter->period_us() > 0)) {
+            stats_timers.push_back(manager.submit_us(1000000, -1, TIMER_DISPATCH, stats_pace, filter));
+        }
+    }
+    stats_timers.push_back(manager.submit_us(1000000, -1, TIMER_DISPATCH, stats_latency));
 
-    manager.submit(1000, stats_fps, &node_bench_vo);
-    manager.submit(1000, stats_fps, &node_bench_record);
-    manager.submit(1000, stats_fps, &node_bench_rtsp);
+    //录像和推流跟不上时编码分支主动抽帧，而不是在缓冲里被悄悄覆盖
+    std::unique_ptr<RateController> venc_rate;
+    if (dynamic_cast<FilterNode*>(venc)) {
+        venc_rate.reset(new RateController(dynamic_cast<FilterNode*>(venc)));
+        stats_timers.push_back(manager.submit_us(500000, -1, TIMER_DISPATCH, &RateController::update, venc_rate.get()));
+    }
     manager.start(); 
 
-    node_cap.show();
+    if (exporter) {
+        exporter->start();
+    }
+    root->start();
+    root->show();
+    if (!trace_path.empty()) {
+        //跳过启动阶段，记录中间3秒的帧时间线
+        std::this_thread::sleep_for(std::chrono::seconds(1)); 
+        TraceRecorder::instance().start();
+        std::this_thread::sleep_for(std::chrono::seconds(3)); 
+        TraceRecorder::instance().stop();
+        TraceRecorder::instance().write_json(trace_path, PipeStamp::node_name);
+        LOG(WARNING) << "trace " << TraceRecorder::instance().event_count() << " events (" << TraceRecorder::instance().dropped_count()
+            << " dropped) to " << trace_path;
+        std::this_thread::sleep_for(std::chrono::seconds(1)); 
+    } else {
+        std::this_thread::sleep_for(std::chrono::seconds(3)); 
+    }
+
+    //单独重启编码分支(模拟编码器重配置)，上游的采集和检测不停
+    if (venc) {
+        int64_t restart_begin = root->now_us();
+        bool drained = venc->stop();
+        int64_t restart_stop = root->now_us();
+        venc->start();
+        LOG(WARNING) << "restart venc branch: drain " << (drained ? "ok" : "timeout") << " in " << (restart_stop - restart_begin) / 1000
+            << "ms, start in " << (root->now_us() - restart_stop) / 1000 << "ms";
+        std::this_thread::sleep_for(std::chrono::seconds(1)); 
+
+        //不停采集，接入一个拉流客户端，1秒后再断开
+        venc->append(&node_viewer, EDGE_DROP_OLDEST, 2);
+        std::this_thread::sleep_for(std::chrono::seconds(1)); 
+        venc->detach(&node_viewer);
+        LOG(WARNING) << "viewer attached for 1s, got " << node_viewer.metrics().frames_out() << " frames";
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1)); 
 
-    node_cap.start();
-    std::this_thread::sleep_for(std::chrono::seconds(5)); 
-    node_cap.stop();
+    if (!root->stop(1000)) {
+        LOG(WARNING) << "pipeline drain timeout!";
+    }
+    for (auto& timer : stats_timers) {
+        timer.cancel();
+    }
 
     std::cout << "wait key..." << std::endl;
     std::getchar(); 
     manager.stop(); 
+    executor.stop();
+    if (exporter) {
+        exporter->stop();
+    }
 
     std::cout << "bye!" << std::endl;
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "thread/pipe_thread.h"
+#include "thread/batch_node.h"
+#include "thread/pipe_graph.h"
 
 using namespace duck::thread;
 
@@ -11,8 +13,17 @@ class CaptureNode : public RootNode
 {
 public:
     CaptureNode(const std::string& node_name, int buff_num = 4) : RootNode(node_name, buff_num) {}
-    void compute(PipeData pipe_data) {
-
+    void compute(PipeData& pipe_data) {
+
+        if (pool()) {
+            BufferRef frame = pool()->alloc();
+            if (frame) {
+                frame->set_size(frame->capacity());
+                pipe_data.set_payload(frame);
+            } else {
+                LOG(WARNING) << name() << " buffer pool is exhausted, frame " << pipe_data.pipe_data_id() << " has no payload!";
+            }
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(20)); 
     }
 };
@@ -21,7 +32,7 @@ class PreProcNode : public FilterNode
 {
 public:
     PreProcNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : FilterNode(node_name, buff_num, period_us) {}
-    void compute(PipeData pipe_data) {
+    void compute(PipeData& pipe_data) {
 
         std::this_thread::sleep_for(std::chrono::milliseconds(19)); 
     }
@@ -31,18 +42,30 @@ class DetectNode : public FilterNode
 {
 public:
     DetectNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : FilterNode(node_name, buff_num, period_us) {}
-    void compute(PipeData pipe_data) {
+    void compute(PipeData& pipe_data) {
 
         std::this_thread::sleep_for(std::chrono::milliseconds(19)); 
     }
 };
 
+//批量推理的检测节点，一批的耗时是固定开销加上每帧的增量，批越大每帧越便宜
+class BatchDetectNode : public BatchNode
+{
+public:
+    BatchDetectNode(const std::string& node_name, int buff_num = 4, size_t max_batch = 8, long max_wait_us = 5000)
+        : BatchNode(node_name, buff_num, max_batch, max_wait_us) {}
+    void compute_batch(std::vector<PipeData>& batch) {
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(15 + 4 * batch.size()));
+    }
+};
+
 
 class VoPreNode : public FilterNode
 {
 public:
     VoPreNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : FilterNode(node_name, buff_num, period_us) {}
-    void compute(PipeData pipe_data) {
+    void compute(PipeData& pipe_data) {
 
         std::this_thread::sleep_for(std::chrono::milliseconds(19)); 
     }
@@ -53,7 +76,7 @@ class VoNode : public FilterNode
 {
 public:
     VoNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : FilterNode(node_name, buff_num, period_us) {}
-    void compute(PipeData pipe_data) {
+    void compute(PipeData& pipe_data) {
 
         std::this_thread::sleep_for(std::chrono::milliseconds(19)); 
     }
@@ -63,7 +86,7 @@ class VencNode : public FilterNode
 {
 public:
     VencNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : FilterNode(node_name, buff_num, period_us) {}
-    void compute(PipeData pipe_data) {
+    void compute(PipeData& pipe_data) {
 
         std::this_thread::sleep_for(std::chrono::milliseconds(25)); 
     }
@@ -73,7 +96,7 @@ class RecordNode : public FilterNode
 {
 public:
     RecordNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : FilterNode(node_name, buff_num, period_us) {}
-    void compute(PipeData pipe_data) {
+    void compute(PipeData& pipe_data) {
 
         std::this_thread::sleep_for(std::chrono::milliseconds(25)); 
     }
@@ -83,7 +106,7 @@ class RtspNode : public FilterNode
 {
 public:
     RtspNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : FilterNode(node_name, buff_num, period_us) {}
-    void compute(PipeData pipe_data) {
+    void compute(PipeData& pipe_data) {
 
         std::this_thread::sleep_for(std::chrono::milliseconds(25)); 
     }
@@ -94,26 +117,45 @@ class BenchMarkNode : public FilterNode
 public:
     BenchMarkNode(const std::string& node_name, int buff_num = 4) : FilterNode(node_name, buff_num), frame_count_(0), pre_frame_count_(0) {}
 
-    void compute(PipeData pipe_data) {
-        frame_count_++;
-        pipe_data.show();
-        LOG(INFO) << "latency: " << pipe_data.latency_ms();
+    //延迟由节点的直方图统计，这里不再逐帧打印
+    void compute(PipeData& pipe_data) {
+        frame_count_.fetch_add(1, std::memory_order_relaxed);
     }
 
     int calc_fps() { 
-        fps_ = (frame_count_ > pre_frame_count_) ? (frame_count_ - pre_frame_count_) : (pre_frame_count_ - frame_count_);
-        pre_frame_count_ = frame_count_;
+        int frame_count = frame_count_.load(std::memory_order_relaxed);
+        fps_ = (frame_count > pre_frame_count_) ? (frame_count - pre_frame_count_) : (pre_frame_count_ - frame_count);
+        pre_frame_count_ = frame_count;
         return fps_;
     }
 
 
 
 protected:
-    int frame_count_;
+    std::atomic<int> frame_count_;
     int pre_frame_count_;
     int fps_;
 };
 
+//登记本文件里的节点类型，供PipeGraph按配置创建
+inline void register_user_nodes()
+{
+    register_root_node<CaptureNode>("capture");
+    register_filter_node<PreProcNode>("pre_proc");
+    register_filter_node<DetectNode>("detect");
+    register_filter_node<VoPreNode>("vo_pre");
+    register_filter_node<VoNode>("vo");
+    register_filter_node<VencNode>("venc");
+    register_filter_node<RecordNode>("record");
+    register_filter_node<RtspNode>("rtsp");
+    NodeFactory::instance().add("batch_detect", [](const NodeConfig& config) -> PipeNode* {
+        return new BatchDetectNode(config.name, config.buff_num, config.params["max_batch"].as_int(8), config.params["max_wait_us"].as_int(5000));
+    });
+    NodeFactory::instance().add("benchmark", [](const NodeConfig& config) -> PipeNode* {
+        return new BenchMarkNode(config.name, config.buff_num);
+    });
+}
+
 
 }//namespace pipe
 }//namespace duck
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "thread/pipe_thread.h"
+
+
+namespace duck {
+namespace thread {
+
+
+//微批处理节点：攒够max_batch帧，或者从这一批的第一帧取到起等了max_wait_us，就调用一次compute_batch()，
+//然后把批里的每一帧按到达的顺序分别放进输出缓冲，下游看到的还是逐帧的数据。
+//上游是MuxNode时一批里可以有多路的帧，用stream_id区分。
+//攒批需要自己的输入队列：以EDGE_SHARED挂上时改用EDGE_DROP_OLDEST，队列深度至少max_batch。
+//等待要有超时，所以设置了executor也使用自己的线程。
+class BatchNode : public FilterNode
+{
+public:
+    BatchNode(const std::string& node_name, int buff_num = 4, size_t max_batch = 8, long max_wait_us = 5000)
+        : FilterNode(node_name, buff_num), max_batch_((max_batch > 0) ? max_batch : 1), max_wait_us_((max_wait_us > 0) ? max_wait_us : 0),
+        first_ns_(0) {
+
+    }
+
+    virtual ~BatchNode() {
+        MetricsRegistry::instance().remove(this);
+    }
+
+    virtual void set_input_edge(int edge_policy, int edge_deep) {
+        if (edge_policy == EDGE_SHARED) {
+            edge_policy = EDGE_DROP_OLDEST;
+        }
+        FilterNode::set_input_edge(edge_policy, std::max(edge_deep, (int)max_batch_));
+    }
+
+    size_t max_batch() {
+        return max_batch_;
+    }
+
+    long max_wait_us() {
+        return max_wait_us_;
+    }
+
+    virtual void process() {
+        ready();
+        std::vector<PipeData> batch;
+        batch.reserve(max_batch_);
+        while(true)
+        {
+            PipeData quit;
+            bool has_quit = collect(batch, &quit);
+            //退出帧之前攒到的帧照常处理
+            if (!batch.empty()) {
+                run_batch(batch);
+                batch.clear();
+            }
+            if (has_quit && handle(quit)) {
+                break;
+            }
+        }
+        exited();
+    }
+
+    //批里的帧可以直接修改，返回后逐帧交给下游
+    virtual void compute_batch(std::vector<PipeData>& batch) = 0;
+
+    //单独处理一帧时当作只有一帧的批
+    virtual void compute(PipeData& pipe_data) {
+        std::vector<PipeData> batch(1, pipe_data);
+        compute_batch(batch);
+        pipe_data = batch[0];
+    }
+
+    //本节点自己调度，不响应上游的通知
+    virtual void on_input() {}
+
+    virtual void collect_metrics(NodeMetricsSnapshot& snapshot) {
+        FilterNode::collect_metrics(snapshot);
+        batch_size_.snapshot(snapshot.batch_size);
+        batch_wait_ns_.snapshot(snapshot.batch_wait_ns);
+    }
+
+protected:
+    virtual void launch(Latch* latch) {
+        CHECK(input_edge_) << name() << " batch node needs an upstream node!";
+        CHECK(!replicas_) << name() << " batch node can't run replicas!";
+        PipeNode::launch(latch);
+    }
+
+    //从输入边攒一批，取到退出帧时停止攒批，返回true
+    bool collect(std::vector<PipeData>& batch, PipeData* quit) {
+        PipeData pipe_data;
+        input_edge_->pop(&pipe_data);
+        first_ns_ = PipeStamp::now_ns();
+        int64_t deadline_ns = first_ns_ + max_wait_us_ * 1000;
+        while(true)
+        {
+            //本节点是被stop()的子图的根，之后的数据都变成退出帧
+            if (quit_requested_.load(std::memory_order_relaxed)) {
+                pipe_data.set_quit(true);
+            }
+            if (pipe_data.quit()) {
+                *quit = pipe_data;
+                return true;
+            }
+
+            //攒批时赶不上截止时间的帧一律丢掉，DEADLINE_PASS也不单独放行，保持批内外的顺序
+            if (!decimate() && !doomed(pipe_data)) {
+                PipeStamp stamp(node_id(), node_gen());
+                stamp.record_dequeue();
+                stamps_.push_back(stamp);
+                batch.push_back(pipe_data);
+                if (batch.size() >= max_batch_) {
+                    return false;
+                }
+            }
+
+            //截止时间到了之后只取队列里已经有的帧
+            int64_t left_us = (deadline_ns - PipeStamp::now_ns()) / 1000;
+            bool ready = (left_us > 0) ? input_edge_->pop(&pipe_data, left_us) : input_edge_->try_pop(&pipe_data);
+            if (!ready) {
+                return false;
+            }
+        }
+    }
+
+    //排空超时后剩下的批直接丢掉
+    void run_batch(std::vector<PipeData>& batch) {
+        if (abort_.load(std::memory_order_relaxed)) {
+            stamps_.clear();
+            return;
+        }
+
+        batch_size_.record(batch.size());
+        batch_wait_ns_.record(PipeStamp::now_ns() - first_ns_);
+        for (auto& stamp : stamps_) {
+            stamp.record_start();
+        }
+
+        compute_batch(batch);
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            PipeStamp& stamp = stamps_[i];
+            stamp.record_end();
+            stamp.record_enqueue();
+            record_metrics(batch[i], stamp);
+            trace(batch[i], stamp);
+            batch[i].push_stamp(stamp);
+            put_data(batch[i]);
+        }
+        frame_count_ += batch.size();
+        stamps_.clear();
+    }
+
+protected:
+    size_t max_batch_;
+    long max_wait_us_;
+    int64_t first_ns_;                  //这一批第一帧取到的时间
+    std::vector<PipeStamp> stamps_;     //和批里的帧一一对应
+    LatencyHistogram batch_size_;       //每批的帧数
+    LatencyHistogram batch_wait_ns_;    //从第一帧取到到开始compute_batch()的时间
+};
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <glog/logging.h>
+
+#include "thread/ringbuffer.h"
+
+
+namespace duck {
+namespace thread {
+
+#ifndef DUCK_CACHE_LINE_SIZE
+#define DUCK_CACHE_LINE_SIZE 64
+#endif
+
+//单写者多读者的广播环形缓冲，用于有多个下游的节点。
+//每个下游通过自己的ReadCursor读取：第一次读取时登记一个消费者编号，之后每个消费者有独立的mutex/condvar，
+//写者发布一帧只需要对head_做一次store，然后只唤醒在parked_位图里登记了挂起的消费者，不会惊群。
+//阻塞读(get_sync)按序号依次读取，每帧恰好读一次；落后超过一圈时直接跳到最新一帧，跳过的帧记在游标里。
+//下游摘下或者重启时用unsubscribe()还回编号，给之后登记的游标用。
+//同时登记超过kMaxConsumers个游标，以及不带游标的读取，退回到共享的condvar上等待。
+template<typename T>
+class BroadcastRing
+{
+public:
+    static const int kMaxConsumers = 64;
+
+    BroadcastRing(size_t deep, const std::string& buff_name = std::string())
+        : deep_((deep > 1) ? deep : 2), slots_(new Slot[deep_]), buff_name_(buff_name) {
+        head_.store(0);
+        parked_.store(0);
+        shared_waiters_.store(0);
+        free_consumers_.store(~0ull);
+        overwritten_.store(0);
+    }
+
+    ~BroadcastRing() {
+        delete[] slots_;
+    }
+
+    BroadcastRing(const BroadcastRing&) = delete;
+    BroadcastRing& operator=(const BroadcastRing&) = delete;
+
+    //只能由一个线程调用
+    void put(const T& value) {
+        size_t seq = head_.load(std::memory_order_relaxed) + 1;
+        Slot& slot = slots_[(seq - 1) % deep_];
+
+        //先把槽标记为写入中，再等正在拷贝这个槽的读者离开
+        size_t old = slot.seq.exchange(0);
+        while(slot.readers.load() != 0) {
+            std::this_thread::yield();
+        }
+        if ((old != 0) && !slot.consumed.load(std::memory_order_relaxed)) {
+            overwritten_.fetch_add(1, std::memory_order_relaxed);
+        }
+        slot.consumed.store(false, std::memory_order_relaxed);
+        slot.value = value;
+        slot.seq.store(seq, std::memory_order_release);
+
+        //发布给所有消费者
+        head_.store(seq);
+
+        uint64_t parked = parked_.load();
+        while(parked)
+        {
+            int index = __builtin_ctzll(parked);
+            parked &= parked - 1;
+            Consumer& consumer = consumers_[index];
+            std::unique_lock<std::mutex> lock(consumer.mutex);
+            consumer.cond.notify_one();
+        }
+        if (shared_waiters_.load() > 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+    T get_async() {
+        ReadCursor cursor;
+        cursor.consumer = kMaxConsumers;
+        cursor.owner = this;
+        return get_async(cursor);
+    }
+
+    T get_sync() {
+        size_t seen = head_.load();
+        wait_newer(kMaxConsumers, seen);
+        T value;
+        size_t seq = 0;
+        while(!read_latest(&value, &seq));
+        return value;
+    }
+
+    //下一帧，落后超过一圈时跳到最新一帧
+    T get_sync(ReadCursor& cursor) {
+        int consumer = subscribe(cursor);
+        T value;
+        while(!try_read_next(cursor, &value)) {
+            if (!wait_newer(consumer, cursor.seq, &cursor)) {
+                return T();
+            }
+        }
+        return value;
+    }
+
+    //最新一帧，可能和上次读到的相同
+    T get_async(ReadCursor& cursor) {
+        int consumer = subscribe(cursor);
+        T value;
+        size_t seq = 0;
+        while(!read_latest(&value, &seq)) {
+            if (!wait_newer(consumer, 0, &cursor)) {
+                return T();
+            }
+        }
+        if (seq > cursor.seq) {
+            cursor.advance(seq);
+        }
+        return value;
+    }
+
+    bool try_get_sync(ReadCursor& cursor, T* value) {
+        subscribe(cursor);
+        return try_read_next(cursor, value);
+    }
+
+    //还回游标登记的消费者编号，调用时这个游标不能有读者在用
+    void unsubscribe(ReadCursor& cursor) {
+        if ((cursor.owner == this) && (cursor.consumer >= 0) && (cursor.consumer < kMaxConsumers)) {
+            free_consumers_.fetch_or(1ull << cursor.consumer);
+        }
+        cursor.consumer = -1;
+        cursor.owner = nullptr;
+    }
+
+    //唤醒所有阻塞的读者，让置位了中止标志的游标返回。不在帧路径上，逐个加锁
+    void wake() {
+        for (int i = 0; i < kMaxConsumers; i++) {
+            std::unique_lock<std::mutex> lock(consumers_[i].mutex);
+            consumers_[i].cond.notify_all();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+
+    bool try_get_async(ReadCursor& cursor, T* value) {
+        size_t seq = 0;
+        if (!read_latest(value, &seq)) {
+            return false;
+        }
+        if (seq > cursor.seq) {
+            cursor.advance(seq);
+        }
+        return true;
+    }
+
+    size_t wptr() {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    size_t deep() {
+        return deep_;
+    }
+
+    //没有被任何读者读过就被覆盖的帧数
+    size_t overwritten() {
+        return overwritten_.load(std::memory_order_relaxed);
+    }
+
+    std::string name() {
+        return buff_name_;
+    }
+
+protected:
+    struct Slot
+    {
+        Slot() : seq(0), readers(0), consumed(false) {}
+
+        std::atomic<size_t> seq;        //槽里数据的序号，0表示空或者正在写
+        std::atomic<int> readers;
+        std::atomic<bool> consumed;
+        T value;
+        char pad_[DUCK_CACHE_LINE_SIZE];
+    };
+
+    struct Consumer
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        char pad_[DUCK_CACHE_LINE_SIZE];
+    };
+
+    //游标第一次在这个缓冲上读取时从空闲位图里取编号最小的一个，取完了用kMaxConsumers
+    int subscribe(ReadCursor& cursor) {
+        if (cursor.owner != this) {
+            int consumer = kMaxConsumers;
+            uint64_t free = free_consumers_.load();
+            while(free)
+            {
+                int index = __builtin_ctzll(free);
+                if (free_consumers_.compare_exchange_weak(free, free & ~(1ull << index))) {
+                    consumer = index;
+                    break;
+                }
+            }
+            cursor.consumer = consumer;
+            cursor.owner = this;
+        }
+        return cursor.consumer;
+    }
+
+    //拷贝序号为seq的数据，槽已经被覆盖或者正在写时返回false
+    bool read(size_t seq, T* value) {
+        Slot& slot = slots_[(seq - 1) % deep_];
+        slot.readers.fetch_add(1);
+        bool ok = (slot.seq.load() == seq);
+        if (ok) {
+            *value = slot.value;
+            //在登记期间标记，写者要等readers归零才会清掉这个标记
+            slot.consumed.store(true, std::memory_order_relaxed);
+        }
+        slot.readers.fetch_sub(1, std::memory_order_release);
+        return ok;
+    }
+
+    bool read_latest(T* value, size_t* seq) {
+        while(true)
+        {
+            size_t head = head_.load(std::memory_order_acquire);
+            if (head == 0) {
+                return false;
+            }
+            if (read(head, value)) {
+                *seq = head;
+                return true;
+            }
+        }
+    }
+
+    bool try_read_next(ReadCursor& cursor, T* value) {
+        while(true)
+        {
+            size_t head = head_.load(std::memory_order_acquire);
+            if (head <= cursor.seq) {
+                return false;
+            }
+
+            //写者可能正在覆盖head + 1 - deep_所在的槽，比它还旧的帧视为已经丢失
+            size_t want = cursor.seq + 1;
+            if ((cursor.seq == 0) || (want + deep_ < head + 2)) {
+                want = head;
+            }
+            if (read(want, value)) {
+                cursor.advance(want);
+                return true;
+            }
+        }
+    }
+
+    //阻塞直到有序号大于seen的数据发布，cursor中止时返回false
+    bool wait_newer(int consumer, size_t seen, const ReadCursor* cursor = nullptr) {
+        if (head_.load() > seen) {
+            return true;
+        }
+
+        bool ready = true;
+        if (consumer >= kMaxConsumers) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            shared_waiters_.fetch_add(1);
+            while(head_.load() <= seen) {
+                if (cursor && cursor->aborted()) {
+                    ready = false;
+                    break;
+                }
+                cond_.wait(lock);
+            }
+            shared_waiters_.fetch_sub(1);
+            return ready;
+        }
+
+        //先登记挂起再检查head_，和写者的先store head_再读parked_配对，不会漏掉唤醒
+        uint64_t bit = 1ull << consumer;
+        Consumer& self = consumers_[consumer];
+        std::unique_lock<std::mutex> lock(self.mutex);
+        parked_.fetch_or(bit);
+        while(head_.load() <= seen) {
+            if (cursor && cursor->aborted()) {
+                ready = false;
+                break;
+            }
+            self.cond.wait(lock);
+        }
+        parked_.fetch_and(~bit);
+        return ready;
+    }
+
+protected:
+    size_t deep_;
+    Slot* slots_;
+    std::string buff_name_;
+    Consumer consumers_[kMaxConsumers];
+
+    char pad0_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<size_t> head_;
+    char pad1_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<uint64_t> parked_;
+    std::atomic<int> shared_waiters_;
+    std::atomic<uint64_t> free_consumers_;  //置位的是还没有分配的消费者编号
+    std::atomic<size_t> overwritten_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+
+}//namespace thread
+}//namespace duck
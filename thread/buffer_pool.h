@@ -0,0 +1,319 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <glog/logging.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+
+namespace duck {
+namespace thread {
+
+class BufferPool;
+
+//缓冲池中的一块内存，引用计数侵入在块头里
+class FrameBuffer
+{
+public:
+    FrameBuffer() : ref_(0), pool_(nullptr), index_(0), data_(nullptr), capacity_(0), size_(0) {}
+
+    uint8_t* data() {
+        return data_;
+    }
+
+    size_t capacity() {
+        return capacity_;
+    }
+
+    size_t size() {
+        return size_;
+    }
+
+    void set_size(size_t size) {
+        CHECK(size <= capacity_) << "FrameBuffer size " << size << " out of capacity " << capacity_;
+        size_ = size;
+    }
+
+    int use_count() {
+        return ref_.load(std::memory_order_relaxed);
+    }
+
+protected:
+    friend class BufferPool;
+    friend class BufferRef;
+
+    std::atomic<int> ref_;
+    BufferPool* pool_;
+    uint32_t index_;
+    uint8_t* data_;
+    size_t capacity_;
+    size_t size_;
+};
+
+//FrameBuffer的句柄，拷贝只增加引用计数，最后一个句柄析构时内存块还给缓冲池
+class BufferRef
+{
+public:
+    BufferRef() : buf_(nullptr) {}
+
+    BufferRef(const BufferRef& other) : buf_(other.buf_) {
+        acquire();
+    }
+
+    BufferRef(BufferRef&& other) : buf_(other.buf_) {
+        other.buf_ = nullptr;
+    }
+
+    ~BufferRef() {
+        release();
+    }
+
+    BufferRef& operator=(const BufferRef& other) {
+        if (buf_ != other.buf_) {
+            release();
+            buf_ = other.buf_;
+            acquire();
+        }
+        return *this;
+    }
+
+    BufferRef& operator=(BufferRef&& other) {
+        if (this != &other) {
+            release();
+            buf_ = other.buf_;
+            other.buf_ = nullptr;
+        }
+        return *this;
+    }
+
+    void reset() {
+        release();
+        buf_ = nullptr;
+    }
+
+    bool empty() const {
+        return (buf_ == nullptr);
+    }
+
+    explicit operator bool() const {
+        return !empty();
+    }
+
+    FrameBuffer* get() {
+        return buf_;
+    }
+
+    FrameBuffer* operator->() {
+        return buf_;
+    }
+
+    uint8_t* data() {
+        return buf_ ? buf_->data() : nullptr;
+    }
+
+    size_t size() {
+        return buf_ ? buf_->size() : 0;
+    }
+
+    int use_count() {
+        return buf_ ? buf_->use_count() : 0;
+    }
+
+protected:
+    friend class BufferPool;
+
+    //接管一个已经持有一次引用的块
+    explicit BufferRef(FrameBuffer* buf) : buf_(buf) {}
+
+    inline void acquire();
+    inline void release();
+
+protected:
+    FrameBuffer* buf_;
+};
+
+//定长内存块缓冲池，启动时一次性分配，之后alloc/释放都不再调用malloc。
+//空闲块用带版本号的无锁栈管理，避免ABA问题。
+//缓冲池必须比所有从它分配出去的BufferRef活得更久。
+class BufferPool
+{
+public:
+    BufferPool(size_t block_size, size_t block_num, const std::string& pool_name = std::string())
+        : block_size_(align_up(block_size)), block_num_(block_num), pool_name_(pool_name),
+        memory_(new uint8_t[block_size_ * block_num_ + kAlign]),
+        blocks_(new FrameBuffer[block_num_]),
+        next_(new std::atomic<uint32_t>[block_num_]) {
+
+        CHECK(block_num_ > 0 && block_num_ < 0xffffffffu) << "BufferPool block_num out of range: " << block_num_;
+
+        uint8_t* base = memory_.get();
+        base += (kAlign - reinterpret_cast<uintptr_t>(base) % kAlign) % kAlign;
+        for (size_t i = 0; i < block_num_; i++) {
+            FrameBuffer& block = blocks_[i];
+            block.pool_ = this;
+            block.index_ = i;
+            block.data_ = base + i * block_size_;
+            block.capacity_ = block_size_;
+            next_[i].store((i + 1 < block_num_) ? (i + 2) : 0);
+        }
+        free_head_.store(make_head(0, 1));
+        available_.store(block_num_);
+    }
+
+    ~BufferPool() {
+        if (available() != block_num_) {
+            LOG(WARNING) << name() << " destroyed with " << (block_num_ - available()) << " buffer in use!";
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    //从缓冲池取一块，池已耗尽时返回空句柄
+    BufferRef alloc() {
+        uint64_t head = free_head_.load(std::memory_order_acquire);
+        while(true)
+        {
+            uint32_t idx = head_index(head);
+            if (idx == 0) {
+                return BufferRef();
+            }
+            uint32_t next = next_[idx - 1].load(std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, make_head(head_tag(head) + 1, next),
+                    std::memory_order_acquire, std::memory_order_acquire)) {
+                FrameBuffer* block = &blocks_[idx - 1];
+                block->ref_.store(1, std::memory_order_relaxed);
+                block->size_ = 0;
+                available_.fetch_sub(1, std::memory_order_relaxed);
+                return BufferRef(block);
+            }
+        }
+    }
+
+    size_t block_size() {
+        return block_size_;
+    }
+
+    size_t block_num() {
+        return block_num_;
+    }
+
+    size_t available() {
+        return available_.load(std::memory_order_relaxed);
+    }
+
+    std::string name() {
+        return pool_name_;
+    }
+
+    //把缓冲池内存的物理页优先放到指定的NUMA节点上，必须在第一次使用这些内存之前调用
+    bool bind_numa(int numa_node) {
+#ifdef SYS_mbind
+        if (numa_node < 0) {
+            return false;
+        }
+        long page_size = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = reinterpret_cast<uintptr_t>(memory_.get());
+        uintptr_t end = begin + memory_size();
+        begin = (begin + page_size - 1) / page_size * page_size;
+        end = end / page_size * page_size;
+        if (end <= begin) {
+            return false;
+        }
+
+        unsigned long node_mask[4] = {0};
+        const unsigned long bits = sizeof(unsigned long) * 8;
+        if (numa_node >= (int)(bits * 4)) {
+            return false;
+        }
+        node_mask[numa_node / bits] = 1ul << (numa_node % bits);
+        if (syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, node_mask, bits * 4, 0) != 0) {
+            LOG(WARNING) << name() << " bind numa node " << numa_node << " failed: " << strerror(errno);
+            return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    uint8_t* memory() {
+        return memory_.get();
+    }
+
+    size_t memory_size() {
+        return block_size_ * block_num_ + kAlign;
+    }
+
+protected:
+    friend class BufferRef;
+
+    void recycle(FrameBuffer* block) {
+        uint32_t idx = block->index_ + 1;
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        while(true)
+        {
+            next_[idx - 1].store(head_index(head), std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, make_head(head_tag(head) + 1, idx),
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        available_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static size_t align_up(size_t size) {
+        return (size + kAlign - 1) / kAlign * kAlign;
+    }
+
+    static uint64_t make_head(uint32_t tag, uint32_t index) {
+        return (static_cast<uint64_t>(tag) << 32) | index;
+    }
+
+    static uint32_t head_tag(uint64_t head) {
+        return static_cast<uint32_t>(head >> 32);
+    }
+
+    static uint32_t head_index(uint64_t head) {
+        return static_cast<uint32_t>(head & 0xffffffffu);
+    }
+
+protected:
+    static const size_t kAlign = 64;
+
+    size_t block_size_;
+    size_t block_num_;
+    std::string pool_name_;
+    std::unique_ptr<uint8_t[]> memory_;
+    std::unique_ptr<FrameBuffer[]> blocks_;
+    std::unique_ptr<std::atomic<uint32_t>[]> next_;
+    std::atomic<uint64_t> free_head_;
+    std::atomic<size_t> available_;
+};
+
+
+inline void BufferRef::acquire() {
+    if (buf_) {
+        buf_->ref_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+inline void BufferRef::release() {
+    if (buf_ && (buf_->ref_.fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+        buf_->pool_->recycle(buf_);
+    }
+}
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <glog/logging.h>
+
+
+namespace duck {
+namespace thread {
+
+
+//可以被Executor调度的任务，调度方负责保证同一个任务不会被并发执行
+class Task
+{
+public:
+    virtual ~Task() {}
+    virtual void run() = 0;
+};
+
+//固定线程数的work-stealing线程池。
+//每个worker有自己的双端队列：自己从尾部取(LIFO，缓存友好)，空闲时从别的worker头部偷(FIFO)。
+//worker之外提交的任务轮流放进各个worker的队列。没有任务时worker挂起在condvar上，
+//提交者只有在确实有worker挂起时才会去碰park_mutex_。
+class Executor
+{
+public:
+    Executor(int worker_num = 0, const std::string& executor_name = std::string("executor"))
+        : worker_num_(worker_num), executor_name_(executor_name), quit_(true), next_worker_(0), pending_(0), idle_(0) {
+
+        if (worker_num_ <= 0) {
+            worker_num_ = std::thread::hardware_concurrency();
+        }
+        if (worker_num_ <= 0) {
+            worker_num_ = 1;
+        }
+        for (int i = 0; i < worker_num_; i++) {
+            workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+        }
+    }
+
+    ~Executor() {
+        stop();
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void start() {
+        if (!quit_) {
+            return;
+        }
+        quit_ = false;
+        for (int i = 0; i < worker_num_; i++) {
+            workers_[i]->thread = std::thread(Executor::thread_handle, this, i);
+        }
+    }
+
+    void stop() {
+        {
+            std::unique_lock<std::mutex> lock(park_mutex_);
+            quit_ = true;
+            park_cond_.notify_all();
+        }
+        for (int i = 0; i < worker_num_; i++) {
+            if (workers_[i]->thread.joinable()) {
+                workers_[i]->thread.join();
+            }
+        }
+    }
+
+    void submit(Task* task) {
+        int index = (t_executor() == this) ? t_worker_index() : (next_worker_.fetch_add(1, std::memory_order_relaxed) % worker_num_);
+
+        Worker& worker = *workers_[index];
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.deque.push_back(task);
+        }
+        pending_.fetch_add(1);
+
+        if (idle_.load() > 0) {
+            std::unique_lock<std::mutex> lock(park_mutex_);
+            park_cond_.notify_one();
+        }
+    }
+
+    int worker_num() {
+        return worker_num_;
+    }
+
+    std::string name() {
+        return executor_name_;
+    }
+
+protected:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task*> deque;
+        std::thread thread;
+    };
+
+    bool pop_local(int index, Task** task) {
+        Worker& worker = *workers_[index];
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        if (worker.deque.empty()) {
+            return false;
+        }
+        *task = worker.deque.back();
+        worker.deque.pop_back();
+        return true;
+    }
+
+    bool steal(int index, Task** task) {
+        for (int i = 1; i < worker_num_; i++) {
+            Worker& victim = *workers_[(index + i) % worker_num_];
+            std::unique_lock<std::mutex> lock(victim.mutex);
+            if (!victim.deque.empty()) {
+                *task = victim.deque.front();
+                victim.deque.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void process(int index) {
+        t_executor() = this;
+        t_worker_index() = index;
+
+        while(!quit_)
+        {
+            Task* task = nullptr;
+            if (pop_local(index, &task) || steal(index, &task)) {
+                pending_.fetch_sub(1);
+                task->run();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(park_mutex_);
+            idle_.fetch_add(1);
+            while(!quit_ && (pending_.load() == 0)) {
+                park_cond_.wait(lock);
+            }
+            idle_.fetch_sub(1);
+        }
+
+        t_executor() = nullptr;
+    }
+
+    static void thread_handle(Executor* executor, int index) {
+        LOG(INFO) << executor->name() << " worker " << index << " is running!";
+        executor->process(index);
+        LOG(INFO) << executor->name() << " worker " << index << " is quit!";
+    }
+
+    static Executor*& t_executor() {
+        static thread_local Executor* executor = nullptr;
+        return executor;
+    }
+
+    static int& t_worker_index() {
+        static thread_local int index = 0;
+        return index;
+    }
+
+protected:
+    int worker_num_;
+    std::string executor_name_;
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::atomic<bool> quit_;
+    std::atomic<int> next_worker_;
+    std::atomic<int> pending_;
+    std::atomic<int> idle_;
+    std::mutex park_mutex_;
+    std::condition_variable park_cond_;
+};
+
+
+}//namespace thread
+}//namespace duck
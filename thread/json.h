@@ -0,0 +1,468 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+
+
+namespace duck {
+namespace thread {
+
+
+enum JsonType
+{
+    JSON_NULL = 0,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+};
+
+//只读的JSON值，用于加载配置文件。取不存在的下标或者键返回null，类型不符时返回默认值
+class JsonValue
+{
+public:
+    typedef std::map<std::string, JsonValue> Object;
+    typedef std::vector<JsonValue> Array;
+
+    JsonValue() : type_(JSON_NULL), bool_(false), number_(0) {}
+
+    int type() const {
+        return type_;
+    }
+
+    bool is_null() const {
+        return type_ == JSON_NULL;
+    }
+
+    bool is_bool() const {
+        return type_ == JSON_BOOL;
+    }
+
+    bool is_number() const {
+        return type_ == JSON_NUMBER;
+    }
+
+    bool is_string() const {
+        return type_ == JSON_STRING;
+    }
+
+    bool is_array() const {
+        return type_ == JSON_ARRAY;
+    }
+
+    bool is_object() const {
+        return type_ == JSON_OBJECT;
+    }
+
+    bool as_bool(bool value = false) const {
+        return is_bool() ? bool_ : value;
+    }
+
+    double as_number(double value = 0) const {
+        return is_number() ? number_ : value;
+    }
+
+    int64_t as_int(int64_t value = 0) const {
+        return is_number() ? (int64_t)number_ : value;
+    }
+
+    std::string as_string(const std::string& value = std::string()) const {
+        return is_string() ? string_ : value;
+    }
+
+    //数组的元素个数或者对象的键数
+    size_t size() const {
+        return is_array() ? array_.size() : (is_object() ? object_.size() : 0);
+    }
+
+    const JsonValue& operator[](size_t index) const {
+        return (is_array() && (index < array_.size())) ? array_[index] : null_value();
+    }
+
+    const JsonValue& operator[](const std::string& key) const {
+        if (!is_object()) {
+            return null_value();
+        }
+        auto it = object_.find(key);
+        return (it != object_.end()) ? it->second : null_value();
+    }
+
+    bool has(const std::string& key) const {
+        return is_object() && (object_.find(key) != object_.end());
+    }
+
+    const Object& members() const {
+        return object_;
+    }
+
+    const Array& elements() const {
+        return array_;
+    }
+
+    static const char* type_name(int type) {
+        static const char* names[] = {"null", "bool", "number", "string", "array", "object"};
+        return ((type >= JSON_NULL) && (type <= JSON_OBJECT)) ? names[type] : "unknown";
+    }
+
+    static const JsonValue& null_value() {
+        static JsonValue value;
+        return value;
+    }
+
+protected:
+    friend class JsonParser;
+
+    int type_;
+    bool bool_;
+    double number_;
+    std::string string_;
+    Array array_;
+    Object object_;
+};
+
+//递归下降的JSON解析器，支持标准JSON和 // 行注释(方便在配置里写说明)，出错时给出行号和列号
+class JsonParser
+{
+public:
+    static const int kMaxDepth = 64;
+
+    static bool parse(const std::string& text, JsonValue* value, std::string* error) {
+        JsonParser parser(text);
+        if (!parser.parse_value(value, 0)) {
+            *error = parser.error_;
+            return false;
+        }
+        parser.skip_space();
+        if (parser.pos_ < text.size()) {
+            parser.fail("unexpected trailing characters");
+            *error = parser.error_;
+            return false;
+        }
+        return true;
+    }
+
+    static bool parse_file(const std::string& path, JsonValue* value, std::string* error) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            *error = "open " + path + " failed";
+            return false;
+        }
+        std::stringstream ss;
+        ss << file.rdbuf();
+        if (!parse(ss.str(), value, error)) {
+            *error = path + ":" + *error;
+            return false;
+        }
+        return true;
+    }
+
+protected:
+    explicit JsonParser(const std::string& text) : text_(text), pos_(0) {}
+
+    bool fail(const std::string& message) {
+        int line = 1;
+        int column = 1;
+        for (size_t i = 0; (i < pos_) && (i < text_.size()); i++) {
+            if (text_[i] == '\n') {
+                line++;
+                column = 1;
+            } else {
+                column++;
+            }
+        }
+        std::stringstream ss;
+        ss << line << ":" << column << ": " << message;
+        error_ = ss.str();
+        return false;
+    }
+
+    void skip_space() {
+        while(pos_ < text_.size())
+        {
+            char c = text_[pos_];
+            if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n')) {
+                pos_++;
+            } else if ((c == '/') && (pos_ + 1 < text_.size()) && (text_[pos_ + 1] == '/')) {
+                while((pos_ < text_.size()) && (text_[pos_] != '\n')) {
+                    pos_++;
+                }
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool match(const char* word) {
+        size_t len = strlen(word);
+        if (text_.compare(pos_, len, word) != 0) {
+            return false;
+        }
+        pos_ += len;
+        return true;
+    }
+
+    bool parse_value(JsonValue* value, int depth) {
+        if (depth > kMaxDepth) {
+            return fail("nesting too deep");
+        }
+
+        skip_space();
+        if (pos_ >= text_.size()) {
+            return fail("unexpected end of input");
+        }
+
+        char c = text_[pos_];
+        switch(c)
+        {
+            case '{':
+                return parse_object(value, depth);
+            case '[':
+                return parse_array(value, depth);
+            case '"':
+                value->type_ = JSON_STRING;
+                return parse_string(&value->string_);
+            case 't':
+            case 'f':
+                if (match("true") || match("false")) {
+                    value->type_ = JSON_BOOL;
+                    value->bool_ = (c == 't');
+                    return true;
+                }
+                return fail("invalid literal");
+            case 'n':
+                if (match("null")) {
+                    value->type_ = JSON_NULL;
+                    return true;
+                }
+                return fail("invalid literal");
+            default:
+                return parse_number(value);
+        }
+    }
+
+    bool parse_number(JsonValue* value) {
+        size_t begin = pos_;
+        if ((pos_ < text_.size()) && (text_[pos_] == '-')) {
+            pos_++;
+        }
+        if ((pos_ >= text_.size()) || !isdigit((unsigned char)text_[pos_])) {
+            return fail("invalid value");
+        }
+        while((pos_ < text_.size()) && (isdigit((unsigned char)text_[pos_]) || ((text_[pos_] != '\0') && strchr(".eE+-", text_[pos_])))) {
+            pos_++;
+        }
+
+        std::string number = text_.substr(begin, pos_ - begin);
+        char* end = nullptr;
+        value->number_ = strtod(number.c_str(), &end);
+        if (*end != '\0') {
+            pos_ = begin;
+            return fail("invalid number " + number);
+        }
+        value->type_ = JSON_NUMBER;
+        return true;
+    }
+
+    static void append_utf8(std::string* out, uint32_t code) {
+        if (code < 0x80) {
+            out->push_back((char)code);
+        } else if (code < 0x800) {
+            out->push_back((char)(0xc0 | (code >> 6)));
+            out->push_back((char)(0x80 | (code & 0x3f)));
+        } else if (code < 0x10000) {
+            out->push_back((char)(0xe0 | (code >> 12)));
+            out->push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+            out->push_back((char)(0x80 | (code & 0x3f)));
+        } else {
+            out->push_back((char)(0xf0 | (code >> 18)));
+            out->push_back((char)(0x80 | ((code >> 12) & 0x3f)));
+            out->push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+            out->push_back((char)(0x80 | (code & 0x3f)));
+        }
+    }
+
+    bool parse_hex4(uint32_t* code) {
+        if (pos_ + 4 > text_.size()) {
+            return fail("invalid unicode escape");
+        }
+        *code = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = text_[pos_++];
+            *code <<= 4;
+            if ((c >= '0') && (c <= '9')) {
+                *code |= c - '0';
+            } else if ((c >= 'a') && (c <= 'f')) {
+                *code |= c - 'a' + 10;
+            } else if ((c >= 'A') && (c <= 'F')) {
+                *code |= c - 'A' + 10;
+            } else {
+                return fail("invalid unicode escape");
+            }
+        }
+        return true;
+    }
+
+    bool parse_string(std::string* out) {
+        pos_++;
+        while(true)
+        {
+            if (pos_ >= text_.size()) {
+                return fail("unterminated string");
+            }
+            char c = text_[pos_++];
+            if (c == '"') {
+                return true;
+            }
+            if ((unsigned char)c < 0x20) {
+                return fail("control character in string");
+            }
+            if (c != '\\') {
+                out->push_back(c);
+                continue;
+            }
+
+            if (pos_ >= text_.size()) {
+                return fail("unterminated string");
+            }
+            c = text_[pos_++];
+            switch(c)
+            {
+                case '"':
+                case '\\':
+                case '/':
+                    out->push_back(c);
+                    break;
+                case 'b':
+                    out->push_back('\b');
+                    break;
+                case 'f':
+                    out->push_back('\f');
+                    break;
+                case 'n':
+                    out->push_back('\n');
+                    break;
+                case 'r':
+                    out->push_back('\r');
+                    break;
+                case 't':
+                    out->push_back('\t');
+                    break;
+                case 'u':
+                    {
+                        uint32_t code = 0;
+                        if (!parse_hex4(&code)) {
+                            return false;
+                        }
+                        //代理对
+                        if ((code >= 0xd800) && (code < 0xdc00) && match("\\u")) {
+                            uint32_t low = 0;
+                            if (!parse_hex4(&low)) {
+                                return false;
+                            }
+                            if ((low < 0xdc00) || (low >= 0xe000)) {
+                                return fail("invalid surrogate pair");
+                            }
+                            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        }
+                        append_utf8(out, code);
+                    }
+                    break;
+                default:
+                    pos_--;
+                    return fail("invalid escape");
+            }
+        }
+    }
+
+    bool parse_array(JsonValue* value, int depth) {
+        pos_++;
+        value->type_ = JSON_ARRAY;
+        skip_space();
+        if ((pos_ < text_.size()) && (text_[pos_] == ']')) {
+            pos_++;
+            return true;
+        }
+
+        while(true)
+        {
+            value->array_.push_back(JsonValue());
+            if (!parse_value(&value->array_.back(), depth + 1)) {
+                return false;
+            }
+            skip_space();
+            if (pos_ >= text_.size()) {
+                return fail("unterminated array");
+            }
+            char c = text_[pos_++];
+            if (c == ']') {
+                return true;
+            }
+            if (c != ',') {
+                pos_--;
+                return fail("expected ',' or ']'");
+            }
+        }
+    }
+
+    bool parse_object(JsonValue* value, int depth) {
+        pos_++;
+        value->type_ = JSON_OBJECT;
+        skip_space();
+        if ((pos_ < text_.size()) && (text_[pos_] == '}')) {
+            pos_++;
+            return true;
+        }
+
+        while(true)
+        {
+            skip_space();
+            if ((pos_ >= text_.size()) || (text_[pos_] != '"')) {
+                return fail("expected object key");
+            }
+            std::string key;
+            if (!parse_string(&key)) {
+                return false;
+            }
+            if (value->object_.count(key)) {
+                return fail("duplicate key \"" + key + "\"");
+            }
+            skip_space();
+            if ((pos_ >= text_.size()) || (text_[pos_] != ':')) {
+                return fail("expected ':'");
+            }
+            pos_++;
+            if (!parse_value(&value->object_[key], depth + 1)) {
+                return false;
+            }
+            skip_space();
+            if (pos_ >= text_.size()) {
+                return fail("unterminated object");
+            }
+            char c = text_[pos_++];
+            if (c == '}') {
+                return true;
+            }
+            if (c != ',') {
+                pos_--;
+                return fail("expected ',' or '}'");
+            }
+        }
+    }
+
+protected:
+    const std::string& text_;
+    size_t pos_;
+    std::string error_;
+};
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <glog/logging.h>
+
+
+namespace duck {
+namespace thread {
+
+
+//一次性的倒数门闩：count_down()到0时唤醒所有wait()的线程。
+//用于等待一组节点全部启动或者全部退出，代替忙等。
+class Latch
+{
+public:
+    explicit Latch(int count) : count_(count) {}
+
+    Latch(const Latch&) = delete;
+    Latch& operator=(const Latch&) = delete;
+
+    void count_down(int n = 1) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        CHECK(count_ >= n) << "latch count down below zero!";
+        count_ -= n;
+        if (count_ == 0) {
+            cond_.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(count_ > 0) {
+            cond_.wait(lock);
+        }
+    }
+
+    //超时返回false，timeout_ms < 0表示一直等待
+    bool wait_for(int64_t timeout_ms) {
+        if (timeout_ms < 0) {
+            wait();
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return count_ == 0; });
+    }
+
+    int count() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+protected:
+    int count_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <glog/logging.h>
+
+#include "thread/ringbuffer.h"
+
+
+namespace duck {
+namespace thread {
+
+#ifndef DUCK_CACHE_LINE_SIZE
+#define DUCK_CACHE_LINE_SIZE 64
+#endif
+
+//无锁写优先环形缓冲，语义与RingBuffer相同：写者覆盖旧的槽，读者总是拿到最新的数据。
+//每个槽有一个序号：偶数表示已发布(2 * (seq + 1))，奇数表示正在被写。head_同时记录最新数据的序号和所在的槽。
+//读者在拷贝前登记到槽的readers计数上，写者从不等待：槽上有读者正在拷贝、或者槽里是最新数据时跳到下一个槽，
+//所以读者被抢占在拷贝中途也不会拖住写者，也不会读到写了一半的数据(T可以是带引用计数的类型，不能用seqlock边写边读)。
+//所有槽都被读者占着时放弃这一帧，记到overwritten()里。
+//阻塞读是可选的：只有当确实有读者挂起时，写者才会去碰mutex/condvar。
+template<typename T>
+class LockFreeRingBuffer
+{
+public:
+    LockFreeRingBuffer(size_t deep, const std::string& buff_name = std::string())
+        : deep_(deep), slot_num_((deep > 1) ? deep : 2), slots_(new Slot[slot_num_]), buff_name_(buff_name) {
+
+        CHECK(deep_ > 0) << "LockFreeRingBuffer deep must be positive!";
+        wptr_.store(0);
+        head_.store(0);
+        overwritten_.store(0);
+        waiters_.store(0);
+    }
+
+    ~LockFreeRingBuffer() {
+        delete[] slots_;
+    }
+
+    LockFreeRingBuffer(const LockFreeRingBuffer&) = delete;
+    LockFreeRingBuffer& operator=(const LockFreeRingBuffer&) = delete;
+
+    void put(const T& value) {
+        size_t seq = wptr_.fetch_add(1, std::memory_order_relaxed);
+        size_t stamp = 2 * (seq + 1);
+
+        //从seq对应的槽开始找一个可以写的槽，最多看一圈
+        for (size_t i = 0; i < slot_num_; i++) {
+            size_t index = (seq + i) % slot_num_;
+            Slot& slot = slots_[index];
+            size_t cur = slot.seq.load(std::memory_order_relaxed);
+            if ((cur & 1) || (index == latest_index()) || !slot.seq.compare_exchange_strong(cur, cur | 1)) {
+                continue;
+            }
+
+            //先占住槽再看读者，和read_latest()里先登记读者再看序号配对(都是seq_cst)，
+            //两边至少有一方看到对方：要么读者看到奇数放弃，要么这里看到读者换下一个槽。
+            //抢占之前head_可能刚好指向了这个槽，也要放回去
+            if ((slot.readers.load() != 0) || (index == latest_index())) {
+                slot.seq.store(cur, std::memory_order_release);
+                continue;
+            }
+
+            if ((cur != 0) && !slot.consumed.load(std::memory_order_relaxed)) {
+                overwritten_.fetch_add(1, std::memory_order_relaxed);
+            }
+            slot.consumed.store(false, std::memory_order_relaxed);
+            slot.value = value;
+            slot.seq.store(stamp, std::memory_order_release);
+            if (!publish(seq + 1, index)) {
+                //已经算进overwritten()，槽再被覆盖时不重复计数
+                slot.consumed.store(true, std::memory_order_relaxed);
+            }
+
+            if (waiters_.load() > 0) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.notify_all();
+            }
+            return;
+        }
+
+        //所有槽都有读者正在拷贝或者正在被别的写者写，放弃这一帧，写者不等待
+        overwritten_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    T get_async() {
+        T value;
+        size_t seq = 0;
+        while(!read_latest(&value, &seq))
+        {
+            LOG(INFO) << name() << " queue is empty, wait an available data...";
+            wait_newer(0);
+        }
+        return value;
+    }
+
+    T get_sync() {
+        T value;
+        size_t seq = 0;
+        wait_newer(wptr());
+        read_latest(&value, &seq);
+        return value;
+    }
+
+    T get_sync(ReadCursor& cursor) {
+        T value;
+        size_t seq = 0;
+        if (!wait_newer(cursor.seq, &cursor)) {
+            return T();
+        }
+        read_latest(&value, &seq);
+        cursor.advance(seq);
+        return value;
+    }
+
+    T get_async(ReadCursor& cursor) {
+        T value;
+        size_t seq = 0;
+        while(!read_latest(&value, &seq)) {
+            if (!wait_newer(0, &cursor)) {
+                return T();
+            }
+        }
+        if (seq > cursor.seq) {
+            cursor.advance(seq);
+        }
+        return value;
+    }
+
+    bool try_get_sync(ReadCursor& cursor, T* value) {
+        size_t seq = 0;
+        if ((wptr() <= cursor.seq) || !read_latest(value, &seq)) {
+            return false;
+        }
+        cursor.advance(seq);
+        return true;
+    }
+
+    bool try_get_async(ReadCursor& cursor, T* value) {
+        size_t seq = 0;
+        if (!read_latest(value, &seq)) {
+            return false;
+        }
+        if (seq > cursor.seq) {
+            cursor.advance(seq);
+        }
+        return true;
+    }
+
+    //没有消费者登记，只清掉游标
+    void unsubscribe(ReadCursor& cursor) {
+        cursor.consumer = -1;
+        cursor.owner = nullptr;
+    }
+
+    //唤醒所有阻塞的读者，让置位了中止标志的游标返回
+    void wake() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+
+    //非阻塞读取最新数据，seq返回该数据的序号(从1开始)，缓冲为空时返回false
+    bool read_latest(T* value, size_t* seq) {
+        while(true)
+        {
+            size_t head = head_.load(std::memory_order_acquire);
+            if (head == 0) {
+                return false;
+            }
+
+            size_t pub = head / slot_num_;
+            Slot& slot = slots_[head % slot_num_];
+            slot.readers.fetch_add(1);
+            if (slot.seq.load() == 2 * pub) {
+                *value = slot.value;
+                //在登记期间标记，写者不会在有读者时清掉这个标记
+                slot.consumed.store(true, std::memory_order_relaxed);
+                slot.readers.fetch_sub(1, std::memory_order_release);
+                *seq = pub;
+                return true;
+            }
+            //槽正在被写或者已经换成别的数据，重新读最新的
+            slot.readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    //阻塞直到有序号大于seen的数据发布，cursor中止时返回false
+    bool wait_newer(size_t seen, const ReadCursor* cursor = nullptr) {
+        if (wptr() > seen) {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiters_.fetch_add(1);
+        bool ready = true;
+        while(wptr() <= seen) {
+            if (cursor && cursor->aborted()) {
+                ready = false;
+                break;
+            }
+            cond_.wait(lock);
+        }
+        waiters_.fetch_sub(1);
+        return ready;
+    }
+
+    //最新发布的数据的序号，0表示还没有数据
+    size_t wptr() {
+        return head_.load(std::memory_order_acquire) / slot_num_;
+    }
+
+    size_t deep() {
+        return deep_;
+    }
+
+    //没有被任何读者读过就被覆盖的帧数
+    size_t overwritten() {
+        return overwritten_.load(std::memory_order_relaxed);
+    }
+
+    std::string name() {
+        return buff_name_;
+    }
+
+protected:
+    struct Slot
+    {
+        Slot() : seq(0), readers(0), consumed(false) {}
+
+        std::atomic<size_t> seq;
+        std::atomic<int> readers;
+        std::atomic<bool> consumed;
+        T value;
+        char pad_[DUCK_CACHE_LINE_SIZE];
+    };
+
+protected:
+    //最新数据所在的槽，还没有数据时返回一个不存在的槽
+    size_t latest_index() {
+        size_t head = head_.load();
+        return (head == 0) ? slot_num_ : (head % slot_num_);
+    }
+
+    //head_只往前走：多个写者时序号更新的数据已经发布，这一帧就作废了，返回false
+    bool publish(size_t pub, size_t index) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        while(true)
+        {
+            if (head / slot_num_ > pub) {
+                overwritten_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (head_.compare_exchange_weak(head, pub * slot_num_ + index)) {
+                return true;
+            }
+        }
+    }
+
+protected:
+    size_t deep_;
+    size_t slot_num_;       //写者要能绕开最新数据的槽，至少2个
+    Slot* slots_;
+    std::string buff_name_;
+
+    char pad0_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<size_t> wptr_;
+    char pad1_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<size_t> head_;      //最新数据的序号 * slot_num_ + 槽号，0表示还没有数据
+    char pad2_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<int> waiters_;
+    std::atomic<size_t> overwritten_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+
+
+}//namespace thread
+}//namespace duck
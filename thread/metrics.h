@@ -0,0 +1,295 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <glog/logging.h>
+
+
+namespace duck {
+namespace thread {
+
+
+struct HistogramSnapshot
+{
+    HistogramSnapshot() : count(0), sum(0), max(0) {}
+
+    //分位数，p取0~1，返回所在桶的中间值
+    int64_t percentile(double p) const {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(p * count);
+        if (rank >= count) {
+            rank = count - 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen > rank) {
+                return std::min(bucket_middle(i), max);
+            }
+        }
+        return max;
+    }
+
+    double mean() const {
+        return (count > 0) ? ((double)sum / count) : 0;
+    }
+
+    //两次快照之间新增的记录，用于按时间窗口看分位数；max取窗口内最高的桶
+    HistogramSnapshot since(const HistogramSnapshot& prev) const {
+        HistogramSnapshot delta;
+        delta.counts.resize(counts.size(), 0);
+        for (size_t i = 0; i < counts.size(); i++) {
+            uint64_t before = (i < prev.counts.size()) ? prev.counts[i] : 0;
+            delta.counts[i] = (counts[i] > before) ? (counts[i] - before) : 0;
+            if (delta.counts[i] > 0) {
+                delta.max = bucket_middle(i);
+            }
+        }
+        delta.count = (count > prev.count) ? (count - prev.count) : 0;
+        delta.sum = (sum > prev.sum) ? (sum - prev.sum) : 0;
+        return delta;
+    }
+
+    static int64_t bucket_middle(size_t index);
+
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    int64_t sum;
+    int64_t max;
+};
+
+//HDR风格的直方图：按2的幂分组，每组再线性分成16个桶，相对误差不超过1/16。
+//可以有多个写者(副本线程、投递到executor的定时器回调)，用relaxed原子操作更新，任意线程都可以随时读快照。
+class LatencyHistogram
+{
+public:
+    static const int kSubBits = 4;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kMaxBits = 40;         //纳秒时大约18分钟
+    static const int kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+    LatencyHistogram() {
+        reset();
+    }
+
+    void record(int64_t value) {
+        if (value < 0) {
+            value = 0;
+        }
+        buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        int64_t max = max_.load(std::memory_order_relaxed);
+        while((value > max) && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed));
+    }
+
+    void snapshot(HistogramSnapshot& snapshot) {
+        snapshot.counts.resize(kBuckets);
+        uint64_t count = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            snapshot.counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            count += snapshot.counts[i];
+        }
+        snapshot.count = count;
+        snapshot.sum = sum_.load(std::memory_order_relaxed);
+        snapshot.max = max_.load(std::memory_order_relaxed);
+    }
+
+    void reset() {
+        for (int i = 0; i < kBuckets; i++) {
+            buckets_[i].store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    static size_t bucket_index(int64_t value) {
+        if (value >= (1ll << kMaxBits)) {
+            value = (1ll << kMaxBits) - 1;
+        }
+        if (value < kSubBuckets) {
+            return value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - kSubBits;
+        return (shift + 1) * kSubBuckets + ((value >> shift) & (kSubBuckets - 1));
+    }
+
+    //桶的下界
+    static int64_t bucket_lower(size_t index) {
+        size_t group = index / kSubBuckets;
+        int64_t sub = index % kSubBuckets;
+        if (group == 0) {
+            return sub;
+        }
+        return (kSubBuckets + sub) << (group - 1);
+    }
+
+protected:
+    std::atomic<uint64_t> buckets_[kBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<int64_t> sum_;
+    std::atomic<int64_t> max_;
+};
+
+inline int64_t HistogramSnapshot::bucket_middle(size_t index) {
+    int64_t lower = LatencyHistogram::bucket_lower(index);
+    int64_t upper = LatencyHistogram::bucket_lower(index + 1);
+    return lower + (upper - lower) / 2;
+}
+
+
+struct NodeMetricsSnapshot
+{
+    NodeMetricsSnapshot() : node_id(0), frames_in(0), frames_out(0), dropped(0), overwritten(0), queue_depth(0),
+        edge_policy(0), edge_occupancy(0), edge_blocked(0), replica_skipped(0), decimation(1), decimated(0), rate_changes(0),
+        deadline_missed(0) {}
+
+    std::string name;
+    uint16_t node_id;
+    uint64_t frames_in;         //从上游取到的帧
+    uint64_t frames_out;        //放进输出缓冲的帧
+    uint64_t dropped;           //上游发布了但本节点没有读到就被覆盖的帧
+    uint64_t overwritten;       //本节点输出缓冲中没有被任何下游读过就被覆盖的帧
+    uint64_t queue_depth;       //输出缓冲里最慢的下游还没有读到的帧数
+    int edge_policy;            //输入边的投递策略，EdgePolicy
+    uint64_t edge_occupancy;    //输入边队列里等待处理的帧数
+    uint64_t edge_blocked;      //上游因为输入边满而等待的次数
+    uint64_t replica_skipped;   //副本模式下超时没有按顺序处理完而跳过的帧数
+    int decimation;             //抽帧倍数，1为不抽帧
+    uint64_t decimated;         //因为抽帧没有处理的帧数
+    uint64_t rate_changes;      //抽帧倍数调整的次数
+    uint64_t deadline_missed;   //赶不上端到端截止时间没有处理的帧数
+    HistogramSnapshot compute_ns;
+    HistogramSnapshot queue_ns;
+    HistogramSnapshot e2e_ns;
+    HistogramSnapshot batch_size;       //微批节点每批的帧数，其他节点为空
+    HistogramSnapshot batch_wait_ns;    //微批节点每批攒批等待的时间
+};
+
+//一个节点的计数器和延迟直方图，由节点自己的线程更新
+class NodeMetrics
+{
+public:
+    NodeMetrics() : frames_in_(0), frames_out_(0), dropped_(0), input_seq_(0) {}
+
+    void on_input() {
+        frames_in_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void on_output() {
+        frames_out_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //输入游标累计跳过的帧数
+    void set_dropped(size_t dropped) {
+        dropped_.store(dropped, std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    //输入游标读到的序号，上游用它计算自己输出缓冲的积压
+    void set_input_seq(size_t seq) {
+        input_seq_.store(seq, std::memory_order_relaxed);
+    }
+
+    uint64_t input_seq() {
+        return input_seq_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t frames_out() {
+        return frames_out_.load(std::memory_order_relaxed);
+    }
+
+    LatencyHistogram& compute_ns() {
+        return compute_ns_;
+    }
+
+    LatencyHistogram& queue_ns() {
+        return queue_ns_;
+    }
+
+    LatencyHistogram& e2e_ns() {
+        return e2e_ns_;
+    }
+
+    void snapshot(NodeMetricsSnapshot& snapshot) {
+        snapshot.frames_in = frames_in_.load(std::memory_order_relaxed);
+        snapshot.frames_out = frames_out_.load(std::memory_order_relaxed);
+        snapshot.dropped = dropped_.load(std::memory_order_relaxed);
+        compute_ns_.snapshot(snapshot.compute_ns);
+        queue_ns_.snapshot(snapshot.queue_ns);
+        e2e_ns_.snapshot(snapshot.e2e_ns);
+    }
+
+protected:
+    std::atomic<uint64_t> frames_in_;
+    std::atomic<uint64_t> frames_out_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> input_seq_;
+    LatencyHistogram compute_ns_;
+    LatencyHistogram queue_ns_;
+    LatencyHistogram e2e_ns_;
+};
+
+
+//可以被MetricsRegistry采集的对象
+class MetricsSource
+{
+public:
+    virtual ~MetricsSource() {}
+    virtual void collect_metrics(NodeMetricsSnapshot& snapshot) = 0;
+};
+
+//所有节点的指标登记处，snapshot()只读原子变量，不会阻塞帧路径
+class MetricsRegistry
+{
+public:
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    //重复登记只保留一份
+    void add(MetricsSource* source) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (std::find(sources_.begin(), sources_.end(), source) == sources_.end()) {
+            sources_.push_back(source);
+        }
+    }
+
+    void remove(MetricsSource* source) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        sources_.erase(std::remove(sources_.begin(), sources_.end(), source), sources_.end());
+    }
+
+    std::vector<NodeMetricsSnapshot> snapshot() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::vector<NodeMetricsSnapshot> snapshots(sources_.size());
+        for (size_t i = 0; i < sources_.size(); i++) {
+            sources_[i]->collect_metrics(snapshots[i]);
+        }
+        return snapshots;
+    }
+
+protected:
+    std::mutex mutex_;
+    std::vector<MetricsSource*> sources_;
+};
+
+
+}//namespace thread
+}//namespace duck
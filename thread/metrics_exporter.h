@@ -0,0 +1,315 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <glog/logging.h>
+
+#include "thread/thread.h"
+#include "thread/metrics.h"
+#include "thread/pipe_edge.h"
+
+
+namespace duck {
+namespace thread {
+
+
+//把MetricsRegistry的快照以OpenMetrics文本格式提供出去，供Prometheus抓取。
+//地址写成"unix:/path/to/socket"或者"[host]:port"，host缺省为127.0.0.1，只能是127.0.0.0/8的回环地址。
+//每个连接返回一次快照后关闭；请求以"GET "开头时带上HTTP头，否则直接返回文本。
+//服务线程默认nice 19，只读节点的原子计数，不碰帧路径上的锁。
+class MetricsExporter : public Thread
+{
+public:
+    MetricsExporter(const std::string& address, const std::string& exporter_name = "metrics_exporter")
+        : Thread(exporter_name), address_(address), listen_fd_(-1), quit_(false) {
+        sched_policy_.nice = 19;
+    }
+
+    virtual ~MetricsExporter() {
+        stop();
+    }
+
+    virtual void start() {
+        if (is_running()) {
+            return;
+        }
+        if (!open_socket()) {
+            return;
+        }
+        quit_.store(false);
+        Thread::start();
+    }
+
+    void stop() {
+        quit_.store(true);
+        join();
+        close_socket();
+    }
+
+    std::string address() {
+        return address_;
+    }
+
+    virtual void process() {
+        while(!quit_.load())
+        {
+            struct pollfd pfd;
+            pfd.fd = listen_fd_;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            //定期醒来检查quit_
+            if (poll(&pfd, 1, 200) <= 0) {
+                continue;
+            }
+
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            serve(fd);
+            close(fd);
+        }
+    }
+
+    //OpenMetrics文本，延迟单位是秒
+    static std::string format(const std::vector<NodeMetricsSnapshot>& snapshots) {
+        std::stringstream ss;
+        format_counter(ss, snapshots, "duck_pipe_frames_in", "Frames taken from the upstream node.", &NodeMetricsSnapshot::frames_in);
+        format_counter(ss, snapshots, "duck_pipe_frames_out", "Frames published to the node output buffer.", &NodeMetricsSnapshot::frames_out);
+        format_counter(ss, snapshots, "duck_pipe_frames_dropped", "Upstream frames overwritten before this node read them.", &NodeMetricsSnapshot::dropped);
+        format_counter(ss, snapshots, "duck_pipe_frames_overwritten", "Output frames overwritten before any downstream node read them.", &NodeMetricsSnapshot::overwritten);
+
+        ss << "# TYPE duck_pipe_queue_depth gauge\n";
+        ss << "# HELP duck_pipe_queue_depth Output frames not yet read by the slowest downstream node.\n";
+        for (const auto& snapshot : snapshots) {
+            ss << "duck_pipe_queue_depth{node=\"" << escape(snapshot.name) << "\"} " << snapshot.queue_depth << "\n";
+        }
+
+        ss << "# TYPE duck_pipe_edge_occupancy gauge\n";
+        ss << "# HELP duck_pipe_edge_occupancy Frames waiting in the node input edge queue.\n";
+        for (const auto& snapshot : snapshots) {
+            ss << "duck_pipe_edge_occupancy{node=\"" << escape(snapshot.name) << "\",policy=\"" << PipeEdge<int>::policy_name(snapshot.edge_policy)
+                << "\"} " << snapshot.edge_occupancy << "\n";
+        }
+        format_counter(ss, snapshots, "duck_pipe_edge_blocked", "Times the upstream node waited on a full lossless input edge.", &NodeMetricsSnapshot::edge_blocked);
+        ss << "# TYPE duck_pipe_decimation gauge\n";
+        ss << "# HELP duck_pipe_decimation The node keeps one of every N input frames.\n";
+        for (const auto& snapshot : snapshots) {
+            ss << "duck_pipe_decimation{node=\"" << escape(snapshot.name) << "\"} " << snapshot.decimation << "\n";
+        }
+        format_counter(ss, snapshots, "duck_pipe_frames_decimated", "Input frames skipped by decimation.", &NodeMetricsSnapshot::decimated);
+        format_counter(ss, snapshots, "duck_pipe_rate_changes", "Times the decimation factor was changed.", &NodeMetricsSnapshot::rate_changes);
+        format_counter(ss, snapshots, "duck_pipe_deadline_missed", "Frames not computed because they could no longer meet the latency budget.", &NodeMetricsSnapshot::deadline_missed);
+        format_counter(ss, snapshots, "duck_pipe_replica_skipped", "Frames skipped because a replica missed the reorder timeout.", &NodeMetricsSnapshot::replica_skipped);
+
+        format_summary(ss, snapshots, "duck_pipe_compute_seconds", "Time spent in compute().", &NodeMetricsSnapshot::compute_ns);
+        format_summary(ss, snapshots, "duck_pipe_queue_seconds", "Time a frame waited in the upstream output buffer.", &NodeMetricsSnapshot::queue_ns);
+        format_summary(ss, snapshots, "duck_pipe_latency_seconds", "Time from frame capture (or the root node start when no capture time is set) to the end of this node.", &NodeMetricsSnapshot::e2e_ns);
+
+        //只有微批节点有批的统计
+        std::vector<NodeMetricsSnapshot> batches;
+        for (const auto& snapshot : snapshots) {
+            if (snapshot.batch_size.count > 0) {
+                batches.push_back(snapshot);
+            }
+        }
+        if (!batches.empty()) {
+            format_summary(ss, batches, "duck_pipe_batch_size", "Frames per compute_batch() call.", &NodeMetricsSnapshot::batch_size, 1);
+            format_summary(ss, batches, "duck_pipe_batch_wait_seconds", "Time from the first frame of a batch to compute_batch().", &NodeMetricsSnapshot::batch_wait_ns);
+        }
+        ss << "# EOF\n";
+        return ss.str();
+    }
+
+protected:
+    void serve(int fd) {
+        //不读数据的客户端最多占住服务线程1s
+        struct timeval timeout;
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        //读掉请求(如果有的话)，最多等100ms
+        char request[1024];
+        ssize_t len = 0;
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 100) > 0) {
+            len = recv(fd, request, sizeof(request), 0);
+        }
+
+        std::string body = format(MetricsRegistry::instance().snapshot());
+        std::string response;
+        if ((len >= 4) && (strncmp(request, "GET ", 4) == 0)) {
+            std::stringstream ss;
+            ss << "HTTP/1.0 200 OK\r\n"
+                << "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                << "Content-Length: " << body.size() << "\r\n"
+                << "Connection: close\r\n\r\n";
+            response = ss.str();
+        }
+        response += body;
+        send_all(fd, response);
+    }
+
+    static void send_all(int fd, const std::string& data) {
+        size_t sent = 0;
+        while(sent < data.size())
+        {
+            ssize_t ret = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            //超时(EAGAIN)或者出错都放弃这个连接
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            sent += ret;
+        }
+    }
+
+    bool open_socket() {
+        if (address_.compare(0, 5, "unix:") == 0) {
+            std::string path = address_.substr(5);
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (path.empty() || (path.size() >= sizeof(addr.sun_path))) {
+                LOG(ERROR) << name() << " invalid unix socket path: " << path;
+                return false;
+            }
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            //上次没清理掉的socket文件可以删，其他文件不动
+            struct stat st;
+            if (lstat(path.c_str(), &st) == 0) {
+                if (!S_ISSOCK(st.st_mode)) {
+                    LOG(ERROR) << name() << " " << path << " exists and is not a socket!";
+                    return false;
+                }
+                unlink(path.c_str());
+            }
+            return bind_listen(AF_UNIX, (struct sockaddr*)&addr, sizeof(addr));
+        }
+
+        std::string host = "127.0.0.1";
+        std::string port = address_;
+        size_t pos = address_.rfind(':');
+        if (pos != std::string::npos) {
+            if (pos > 0) {
+                host = address_.substr(0, pos);
+            }
+            port = address_.substr(pos + 1);
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(port.c_str()));
+        if ((addr.sin_port == 0) || (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)) {
+            LOG(ERROR) << name() << " invalid tcp address: " << address_;
+            return false;
+        }
+        //指标不做鉴权，不能暴露到本机以外
+        if ((ntohl(addr.sin_addr.s_addr) >> 24) != 127) {
+            LOG(ERROR) << name() << " only loopback addresses are allowed: " << address_;
+            return false;
+        }
+        return bind_listen(AF_INET, (struct sockaddr*)&addr, sizeof(addr));
+    }
+
+    bool bind_listen(int family, struct sockaddr* addr, socklen_t addr_len) {
+        listen_fd_ = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0) {
+            LOG(ERROR) << name() << " create socket failed: " << strerror(errno);
+            return false;
+        }
+        if (family == AF_INET) {
+            int on = 1;
+            setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        }
+        if ((bind(listen_fd_, addr, addr_len) != 0) || (listen(listen_fd_, 8) != 0)) {
+            LOG(ERROR) << name() << " listen on " << address_ << " failed: " << strerror(errno);
+            close_socket();
+            return false;
+        }
+        LOG(INFO) << name() << " serving metrics on " << address_;
+        return true;
+    }
+
+    void close_socket() {
+        if (listen_fd_ >= 0) {
+            close(listen_fd_);
+            listen_fd_ = -1;
+            struct stat st;
+            std::string path = address_.substr(5);
+            if ((address_.compare(0, 5, "unix:") == 0) && (lstat(path.c_str(), &st) == 0) && S_ISSOCK(st.st_mode)) {
+                unlink(path.c_str());
+            }
+        }
+    }
+
+    static std::string escape(const std::string& value) {
+        std::string escaped;
+        for (const auto c : value) {
+            if (c == '\\') {
+                escaped += "\\\\";
+            } else if (c == '"') {
+                escaped += "\\\"";
+            } else if (c == '\n') {
+                escaped += "\\n";
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    static void format_counter(std::stringstream& ss, const std::vector<NodeMetricsSnapshot>& snapshots, const char* family,
+        const char* help, uint64_t NodeMetricsSnapshot::*field) {
+        ss << "# TYPE " << family << " counter\n";
+        ss << "# HELP " << family << " " << help << "\n";
+        for (const auto& snapshot : snapshots) {
+            ss << family << "_total{node=\"" << escape(snapshot.name) << "\"} " << snapshot.*field << "\n";
+        }
+    }
+
+    static void format_summary(std::stringstream& ss, const std::vector<NodeMetricsSnapshot>& snapshots, const char* family,
+        const char* help, HistogramSnapshot NodeMetricsSnapshot::*field, double scale = 1e9) {
+        static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        ss << "# TYPE " << family << " summary\n";
+        ss << "# HELP " << family << " " << help << "\n";
+        for (const auto& snapshot : snapshots) {
+            const HistogramSnapshot& histogram = snapshot.*field;
+            std::string node = escape(snapshot.name);
+            for (const auto quantile : quantiles) {
+                ss << family << "{node=\"" << node << "\",quantile=\"" << quantile << "\"} " << histogram.percentile(quantile) / scale << "\n";
+            }
+            ss << family << "_sum{node=\"" << node << "\"} " << histogram.sum / scale << "\n";
+            ss << family << "_count{node=\"" << node << "\"} " << histogram.count << "\n";
+        }
+    }
+
+protected:
+    std::string address_;
+    int listen_fd_;
+    std::atomic<bool> quit_;
+};
+
+
+}//namespace thread
+}//namespace duck
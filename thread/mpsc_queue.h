@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <glog/logging.h>
+
+
+namespace duck {
+namespace thread {
+
+
+//侵入式无锁多生产者单消费者队列(Vyukov)。
+//T需要有一个std::atomic<T*> next_成员；push()可以在任意线程调用且从不阻塞，pop()只能由一个线程调用。
+template<typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() {
+        stub_.next_.store(nullptr);
+        head_.store(&stub_);
+        tail_ = &stub_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T* node) {
+        node->next_.store(nullptr, std::memory_order_relaxed);
+        T* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next_.store(node, std::memory_order_release);
+    }
+
+    //队列为空，或者某个生产者正在push的中途，返回nullptr
+    T* pop() {
+        T* tail = tail_;
+        T* next = tail->next_.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        push(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+protected:
+    std::atomic<T*> head_;
+    T* tail_;
+    T stub_;
+};
+
+
+}//namespace thread
+}//namespace duck
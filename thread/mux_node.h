@@ -0,0 +1,277 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <glog/logging.h>
+
+#include "thread/pipe_thread.h"
+
+
+namespace duck {
+namespace thread {
+
+
+class MuxNode;
+
+//MuxNode在每一路源下面挂的输入节点，没有自己的线程：源的put_data()直接把帧放进输入边并唤醒MuxNode
+class MuxInput : public PipeNode
+{
+public:
+    MuxInput(const std::string& node_name, MuxNode* mux) : PipeNode(node_name, 1), mux_(mux) {}
+
+    virtual void process() {}
+
+protected:
+    virtual void launch(Latch* latch) {
+        reset_state();
+        latch->count_down();
+    }
+
+    virtual void deliver(const PipeData& pipe_data);
+
+protected:
+    MuxNode* mux_;
+};
+
+//多路复用节点：多路RootNode源共享同一棵处理子树，处理节点和线程数不随路数增加。
+//每一路有自己的有界输入队列(边策略同append())，MuxNode的线程按加权轮询(DRR)从各路取帧发布给下游：
+//每轮给每一路weight的额度，每帧消耗1，队列空了额度清零，不能攒到下一轮；权重都为1时就是轮询。
+//同一路的帧按顺序进入下游，pipe_data_id在各路内独立编号，用stream_id区分。
+//start()/stop()同时启停所有源；源要比MuxNode后析构。
+class MuxNode : public PipeNode
+{
+public:
+    MuxNode(const std::string& node_name, int buff_num = 4) : PipeNode(node_name, buff_num), current_(0), frame_count_(0), waiters_(0) {}
+
+    virtual ~MuxNode() {
+        //先退出登记，采集线程不会再读到正在析构的各路输入
+        MetricsRegistry::instance().remove(this);
+        for (auto& stream : streams_) {
+            stream->source->detach(stream->input.get());
+        }
+    }
+
+    //接入一路源，返回分配的stream_id。只能在start()之前调用
+    int add_stream(RootNode* source, int weight = 1, int edge_policy = EDGE_DROP_OLDEST, int edge_deep = -1) {
+        CHECK(state() != NODE_RUNNING) << name() << " can't add stream while running!";
+        CHECK(source->state() != NODE_RUNNING) << name() << " can't add running source " << source->name();
+        CHECK(edge_policy != EDGE_SHARED) << name() << " stream input needs its own queue!";
+
+        //这一路完整建好(包括输入边)之后才放进streams_，采集线程只会看到建好的。
+        //建的过程中会拿MetricsRegistry和源的锁，不能持有streams_mutex_，否则和采集的加锁顺序相反
+        int stream_id = stream_count();
+        std::unique_ptr<Stream> stream(new Stream);
+        stream->source = source;
+        stream->input.reset(new MuxInput(source->name() + "_mux", this));
+        stream->weight = (weight > 0) ? weight : 1;
+        stream->deficit = 0;
+        stream->frames.store(0);
+        source->set_stream_id(stream_id);
+        source->append(stream->input.get(), edge_policy, (edge_deep > 0) ? edge_deep : buff_num_);
+
+        std::unique_lock<std::mutex> lock(streams_mutex_);
+        streams_.push_back(std::move(stream));
+        return stream_id;
+    }
+
+    size_t stream_count() {
+        std::unique_lock<std::mutex> lock(streams_mutex_);
+        return streams_.size();
+    }
+
+    //这一路已经发布给下游的帧数
+    uint64_t stream_frames(int stream_id) {
+        std::unique_lock<std::mutex> lock(streams_mutex_);
+        CHECK((stream_id >= 0) && ((size_t)stream_id < streams_.size())) << name() << " unknown stream id: " << stream_id;
+        return streams_[stream_id]->frames.load(std::memory_order_relaxed);
+    }
+
+    //先停所有源，各路的退出帧排在已有数据后面；MuxNode把各路队列取空后再通知下游退出
+    virtual bool stop(int64_t drain_timeout_ms = kDrainTimeoutMs) {
+        bool drained = true;
+        for (const auto source : sources()) {
+            drained = source->stop(drain_timeout_ms) && drained;
+        }
+        return PipeNode::stop(drain_timeout_ms) && drained;
+    }
+
+    virtual void process() {
+        ready();
+        while(true)
+        {
+            //排空超时后各路剩下的帧不再转发，下游也被唤醒各自退出，不用再等
+            bool abort = abort_.load();
+            PipeData pipe_data;
+            if (!abort && schedule(&pipe_data)) {
+                forward(pipe_data);
+                continue;
+            }
+
+            if (abort || quit_requested_.load()) {
+                PipeData quit(frame_count_, true);
+                put_data(quit);
+                if (abort || wait_child_quit(10)) {
+                    break;
+                }
+                continue;
+            }
+            wait_input(10);
+        }
+        exited();
+    }
+
+    //各路源的线程每帧调用，只有本节点挂起等待时才加锁唤醒，各路不会在input_mutex_上互相排队。
+    //入队和读waiters_之间的fence和wait_input()里先登记再查队列配对，两边至少有一方看到对方
+    void notify_input() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load() > 0) {
+            std::unique_lock<std::mutex> lock(input_mutex_);
+            input_cond_.notify_one();
+        }
+    }
+
+    //各路输入队列里丢掉的帧算在本节点上，积压是各路之和。add_stream()可能同时在加一路，要持streams_mutex_
+    virtual void collect_metrics(NodeMetricsSnapshot& snapshot) {
+        PipeNode::collect_metrics(snapshot);
+        uint64_t dropped = 0;
+        uint64_t occupancy = 0;
+        std::unique_lock<std::mutex> lock(streams_mutex_);
+        for (auto& stream : streams_) {
+            PipeEdge<PipeData>* edge = stream->input->input_edge();
+            dropped += edge->dropped_count();
+            occupancy += edge->occupancy();
+        }
+        snapshot.dropped = dropped;
+        snapshot.edge_occupancy = occupancy;
+    }
+
+protected:
+    struct Stream
+    {
+        RootNode* source;
+        std::unique_ptr<MuxInput> input;
+        int weight;
+        int deficit;
+        std::atomic<uint64_t> frames;
+    };
+
+    //本节点和下游先启动，再启动各路源
+    virtual void launch(Latch* latch) {
+        current_ = 0;
+        {
+            std::unique_lock<std::mutex> lock(streams_mutex_);
+            for (auto& stream : streams_) {
+                stream->deficit = 0;
+            }
+        }
+        PipeNode::launch(latch);
+        for (const auto source : sources()) {
+            source->start();
+        }
+    }
+
+    //各路源的快照。启停源时会拿MetricsRegistry和源的锁，不能持有streams_mutex_
+    std::vector<RootNode*> sources() {
+        std::vector<RootNode*> list;
+        std::unique_lock<std::mutex> lock(streams_mutex_);
+        for (auto& stream : streams_) {
+            list.push_back(stream->source);
+        }
+        return list;
+    }
+
+    //按DRR取下一帧，各路都没有数据时返回false。源的退出帧只表示这一路结束，不往下游传
+    bool schedule(PipeData* pipe_data) {
+        size_t num = streams_.size();
+        for (size_t visited = 0; (num > 0) && (visited <= num); ) {
+            Stream& stream = *streams_[current_];
+            if (stream.deficit > 0) {
+                if (stream.input->input_edge()->try_pop(pipe_data)) {
+                    if (pipe_data->quit()) {
+                        continue;
+                    }
+                    stream.deficit--;
+                    stream.frames.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                stream.deficit = 0;
+            }
+            current_ = (current_ + 1) % num;
+            streams_[current_]->deficit += streams_[current_]->weight;
+            visited++;
+        }
+        return false;
+    }
+
+    void forward(PipeData& pipe_data) {
+        PipeStamp stamp(node_id(), node_gen());
+        stamp.record_dequeue();
+        stamp.record_start();
+        stamp.record_end();
+        stamp.record_enqueue();
+
+        metrics_.on_input();
+        PipeStamp* prev = pipe_data.back_stamp();
+        if (prev) {
+            metrics_.queue_ns().record(stamp.queue_ns(*prev));
+            metrics_.e2e_ns().record(stamp.end_ns() - pipe_data.origin_ns());
+        }
+        trace(pipe_data, stamp);
+        pipe_data.push_stamp(stamp);
+        put_data(pipe_data);
+        frame_count_++;
+    }
+
+    bool has_input() {
+        for (auto& stream : streams_) {
+            if (stream->input->input_edge()->occupancy() > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void wait_input(int64_t timeout_ms) {
+        std::unique_lock<std::mutex> lock(input_mutex_);
+        waiters_.fetch_add(1);
+        input_cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return has_input() || quit_requested_.load(); });
+        waiters_.fetch_sub(1);
+    }
+
+protected:
+    std::vector<std::unique_ptr<Stream> > streams_;
+    std::mutex streams_mutex_;              //add_stream()发布新的一路时和采集、启停互斥，帧路径上只在启动后读streams_，不加锁
+    size_t current_;
+    size_t frame_count_;
+    std::mutex input_mutex_;
+    std::condition_variable input_cond_;
+    std::atomic<int> waiters_;              //本节点挂起在input_cond_上
+};
+
+inline void MuxInput::deliver(const PipeData& pipe_data) {
+    int state = state_.load();
+    if ((state != NODE_RUNNING) && (state != NODE_DRAINING)) {
+        return;
+    }
+
+    //单独摘下这一路时(detach)把之后的帧变成退出帧
+    if (pipe_data.quit() || quit_requested_.load(std::memory_order_relaxed)) {
+        PipeData quit = pipe_data;
+        quit.set_quit(true);
+        input_edge_->put(quit, true);
+        exited();
+    } else {
+        metrics_.on_input();
+        metrics_.on_output();
+        input_edge_->put(pipe_data);
+    }
+    mux_->notify_input();
+}
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <glog/logging.h>
+
+#include "thread/ringbuffer.h"
+#include "thread/lockfree_ringbuffer.h"
+#include "thread/broadcast_ring.h"
+
+namespace duck {
+namespace thread {
+
+
+enum PipeBuffType
+{
+    PIPE_BUFF_MUTEX = 0,        //RingBuffer, mutex + condvar
+    PIPE_BUFF_LOCKFREE,         //LockFreeRingBuffer
+    PIPE_BUFF_BROADCAST,        //BroadcastRing, 单写者，每个下游独立唤醒，适合扇出的节点
+};
+
+//PipeNode输出缓冲的接口，用于在运行时选择具体的环形缓冲实现
+template<typename T>
+class PipeBuffer
+{
+public:
+    virtual ~PipeBuffer() {}
+
+    virtual void put(const T& value) = 0;
+    virtual T get_sync() = 0;
+    virtual T get_async() = 0;
+    virtual T get_sync(ReadCursor& cursor) = 0;
+    virtual T get_async(ReadCursor& cursor) = 0;
+    virtual bool try_get_sync(ReadCursor& cursor, T* value) = 0;
+    virtual bool try_get_async(ReadCursor& cursor, T* value) = 0;
+    virtual void unsubscribe(ReadCursor& cursor) = 0;
+    virtual void wake() = 0;
+    virtual size_t overwritten() = 0;
+    virtual size_t wptr() = 0;
+    virtual std::string name() = 0;
+};
+
+template<typename T, typename B>
+class PipeBufferAdapter : public PipeBuffer<T>
+{
+public:
+    PipeBufferAdapter(size_t deep, const std::string& buff_name) : buff_(deep, buff_name) {}
+
+    void put(const T& value) {
+        buff_.put(value);
+    }
+
+    T get_sync() {
+        return buff_.get_sync();
+    }
+
+    T get_async() {
+        return buff_.get_async();
+    }
+
+    T get_sync(ReadCursor& cursor) {
+        return buff_.get_sync(cursor);
+    }
+
+    T get_async(ReadCursor& cursor) {
+        return buff_.get_async(cursor);
+    }
+
+    bool try_get_sync(ReadCursor& cursor, T* value) {
+        return buff_.try_get_sync(cursor, value);
+    }
+
+    bool try_get_async(ReadCursor& cursor, T* value) {
+        return buff_.try_get_async(cursor, value);
+    }
+
+    void unsubscribe(ReadCursor& cursor) {
+        buff_.unsubscribe(cursor);
+    }
+
+    void wake() {
+        buff_.wake();
+    }
+
+    size_t overwritten() {
+        return buff_.overwritten();
+    }
+
+    size_t wptr() {
+        return buff_.wptr();
+    }
+
+    std::string name() {
+        return buff_.name();
+    }
+
+protected:
+    B buff_;
+};
+
+template<typename T>
+PipeBuffer<T>* create_pipe_buffer(int buff_type, size_t deep, const std::string& buff_name = std::string())
+{
+    switch(buff_type)
+    {
+        case PIPE_BUFF_MUTEX:
+            return new PipeBufferAdapter<T, RingBuffer<T> >(deep, buff_name);
+        case PIPE_BUFF_LOCKFREE:
+            return new PipeBufferAdapter<T, LockFreeRingBuffer<T> >(deep, buff_name);
+        case PIPE_BUFF_BROADCAST:
+            return new PipeBufferAdapter<T, BroadcastRing<T> >(deep, buff_name);
+        default:
+            LOG(FATAL) << "unknown pipe buffer type: " << buff_type;
+    }
+    return nullptr;
+}
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <glog/logging.h>
+
+#include "thread/queue.h"
+
+
+namespace duck {
+namespace thread {
+
+
+enum EdgePolicy
+{
+    EDGE_SHARED = 0,        //读上游共享的输出环形缓冲，写优先，读者可能跳帧或者重复读到旧帧
+    EDGE_LOSSLESS,          //有界FIFO，满了上游等待(背压)，不丢帧。上游因此不作为executor任务运行
+    EDGE_DROP_OLDEST,       //有界FIFO，满了丢掉最旧的一帧
+    EDGE_DROP_NEWEST,       //有界FIFO，满了丢掉新来的一帧
+    EDGE_LATEST_ONLY,       //只保留最新一帧，每帧最多被读一次
+};
+
+//节点之间的一条边，属于下游节点，由上游的put_data()写入。
+//除了EDGE_SHARED以外的策略都用SafeQueue实现，每条边有自己的占用和丢帧计数。
+template<typename T>
+class PipeEdge
+{
+public:
+    PipeEdge(int policy, size_t deep, const std::string& edge_name = std::string())
+        : policy_(policy), queue_((policy == EDGE_LATEST_ONLY) ? 2 : (int)deep, edge_name), closed_(false), pushed_(0), dropped_(0), blocked_(0) {
+        CHECK((policy > EDGE_SHARED) && (policy <= EDGE_LATEST_ONLY)) << "unknown edge policy: " << policy;
+    }
+
+    PipeEdge(const PipeEdge&) = delete;
+    PipeEdge& operator=(const PipeEdge&) = delete;
+
+    //写入一帧，返回false表示这一帧(或者下游已经关闭)被丢弃。
+    //force为true时无论什么策略都不丢这一帧，用于退出帧：无损的边排在已有数据后面(可能阻塞)，
+    //其他策略必要时丢掉最旧的一帧腾出位置。
+    bool put(const T& value, bool force = false) {
+        if (closed_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        int policy = (force && (policy_ != EDGE_LOSSLESS)) ? EDGE_DROP_OLDEST : policy_;
+        switch(policy)
+        {
+            case EDGE_LOSSLESS:
+                if (!queue_.try_push(value)) {
+                    blocked_.fetch_add(1, std::memory_order_relaxed);
+                    //下游退出后close()，不会永远阻塞在这里
+                    while(!queue_.push_for(value, 10000)) {
+                        if (closed_.load(std::memory_order_acquire)) {
+                            return false;
+                        }
+                    }
+                }
+                break;
+            case EDGE_LATEST_ONLY:
+                //先清掉还没被读走的旧帧，队列里最多只留这一帧
+                {
+                    T oldest;
+                    while(queue_.try_pop(&oldest)) {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                while(!queue_.try_push(value)) {
+                    T oldest;
+                    if (queue_.try_pop(&oldest)) {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                break;
+            case EDGE_DROP_NEWEST:
+                if (!queue_.try_push(value)) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                break;
+            default:
+                while(!queue_.try_push(value)) {
+                    T oldest;
+                    if (queue_.try_pop(&oldest)) {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                break;
+        }
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //timeout_us < 0表示一直等待，超时返回false
+    bool pop(T* value, int64_t timeout_us = -1) {
+        return queue_.pop_for(value, timeout_us);
+    }
+
+    bool try_pop(T* value) {
+        return queue_.try_pop(value);
+    }
+
+    //排空中止时唤醒阻塞在pop()上的下游：不管什么策略都不阻塞，队列满了丢掉最旧的一帧
+    void interrupt(const T& value) {
+        if (closed_.load(std::memory_order_acquire)) {
+            return;
+        }
+        while(!queue_.try_push(value)) {
+            T oldest;
+            if (queue_.try_pop(&oldest)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //下游不再读取，之后的put()直接返回，阻塞中的上游也会退出等待
+    void close() {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    void reopen() {
+        closed_.store(false, std::memory_order_release);
+    }
+
+    //丢掉队列里剩下的数据，重新启动前调用
+    void clear() {
+        T value;
+        while(queue_.try_pop(&value));
+    }
+
+    int policy() {
+        return policy_;
+    }
+
+    size_t occupancy() {
+        return queue_.count();
+    }
+
+    int deep() {
+        return (policy_ == EDGE_LATEST_ONLY) ? 1 : queue_.deep();
+    }
+
+    uint64_t pushed_count() {
+        return pushed_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped_count() {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    //上游因为队列满而等待的次数
+    uint64_t blocked_count() {
+        return blocked_.load(std::memory_order_relaxed);
+    }
+
+    std::string name() {
+        return queue_.name();
+    }
+
+    static std::string policy_name(int policy) {
+        switch(policy)
+        {
+            case EDGE_SHARED:
+                return "shared";
+            case EDGE_LOSSLESS:
+                return "lossless";
+            case EDGE_DROP_OLDEST:
+                return "drop_oldest";
+            case EDGE_DROP_NEWEST:
+                return "drop_newest";
+            case EDGE_LATEST_ONLY:
+                return "latest_only";
+            default:
+                return std::to_string(policy);
+        }
+    }
+
+protected:
+    int policy_;
+    SafeQueue<T> queue_;
+    std::atomic<bool> closed_;
+    std::atomic<uint64_t> pushed_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> blocked_;
+};
+
+
+}//namespace thread
+}//namespace duck
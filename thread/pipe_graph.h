@@ -0,0 +1,581 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "thread/pipe_thread.h"
+#include "thread/json.h"
+
+
+namespace duck {
+namespace thread {
+
+
+//配置文件里一个节点的描述
+struct NodeConfig
+{
+    NodeConfig() : buff_num(4), buff_type(PIPE_BUFF_MUTEX), period_us(-1), spin_us(0), edge_policy(EDGE_SHARED), edge_deep(-1),
+        pool_block_size(0), pool_block_num(0), has_sched(false), replica_num(1), replica_dispatch(REPLICA_ROUND_ROBIN), replica_window(0),
+        replica_timeout_us(-1), latency_budget_us(0), deadline_policy(DEADLINE_DROP), has_deadline(false) {}
+
+    std::string name;
+    std::string type;
+    std::string parent;         //空表示根节点
+    int buff_num;
+    int buff_type;
+    long period_us;             //拉模式的周期，<= 0表示推模式
+    long spin_us;
+    int edge_policy;            //和上游之间的边
+    int edge_deep;
+    size_t pool_block_size;     //只用于根节点
+    size_t pool_block_num;
+    bool has_sched;
+    SchedPolicy sched;
+    int replica_num;            //compute()的副本数，1为不开副本
+    int replica_dispatch;
+    size_t replica_window;
+    int64_t replica_timeout_us;
+    int64_t latency_budget_us;  //只用于根节点，<= 0表示不限
+    int deadline_policy;        //赶不上截止时间的帧怎么处理
+    bool has_deadline;
+    JsonValue params;           //节点类型自己的参数，由创建函数解释
+};
+
+typedef std::function<PipeNode*(const NodeConfig&)> NodeCreator;
+
+//节点类型的注册表，类型名 -> 创建函数
+class NodeFactory
+{
+public:
+    static NodeFactory& instance() {
+        static NodeFactory factory;
+        return factory;
+    }
+
+    void add(const std::string& type, NodeCreator creator) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (creators_.count(type)) {
+            LOG(WARNING) << "node type " << type << " is registered again!";
+        }
+        creators_[type] = creator;
+    }
+
+    bool has(const std::string& type) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return creators_.count(type) > 0;
+    }
+
+    PipeNode* create(const NodeConfig& config) {
+        NodeCreator creator;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = creators_.find(config.type);
+            if (it == creators_.end()) {
+                return nullptr;
+            }
+            creator = it->second;
+        }
+        return creator(config);
+    }
+
+    std::vector<std::string> types() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::vector<std::string> types;
+        for (const auto& item : creators_) {
+            types.push_back(item.first);
+        }
+        return types;
+    }
+
+protected:
+    NodeFactory() {}
+
+protected:
+    std::mutex mutex_;
+    std::map<std::string, NodeCreator> creators_;
+};
+
+//构造函数是(name, buff_num)的根节点
+template<typename T>
+void register_root_node(const std::string& type)
+{
+    NodeFactory::instance().add(type, [](const NodeConfig& config) -> PipeNode* {
+        return new T(config.name, config.buff_num);
+    });
+}
+
+//构造函数是(name, buff_num, period_us)的节点
+template<typename T>
+void register_filter_node(const std::string& type)
+{
+    NodeFactory::instance().add(type, [](const NodeConfig& config) -> PipeNode* {
+        return new T(config.name, config.buff_num, config.period_us);
+    });
+}
+
+//从JSON配置构建的一棵流水线，拥有所有节点。格式：
+//{
+//    "nodes": [
+//        {"name": "node_cap", "type": "capture", "buff_num": 4, "pool": {"block_size": 460800, "block_num": 64}, "sched": {"cpus": [0]},
+//            "latency_budget_us": 200000},
+//        {"name": "node_detect", "type": "detect", "parent": "node_cap", "buff_type": "broadcast", "deadline": "pass"},
+//        {"name": "node_record", "type": "record", "parent": "node_detect", "period_us": 50000, "edge": {"policy": "lossless", "deep": 8}, "deadline": "ignore"}
+//    ]
+//}
+//没有parent的节点是根节点，必须恰好一个；子节点按在数组里的顺序挂到上游。
+//加载时先检查整张图(重名、未知类型、未知字段、找不到上游、环、不可达的节点)，全部通过才创建节点。
+class PipeGraph
+{
+public:
+    PipeGraph() : root_(nullptr) {}
+
+    ~PipeGraph() {
+        if (root_) {
+            root_->stop();
+        }
+        //先析构下游，根节点的缓冲池最后释放
+        while(!nodes_.empty()) {
+            nodes_.pop_back();
+        }
+    }
+
+    PipeGraph(const PipeGraph&) = delete;
+    PipeGraph& operator=(const PipeGraph&) = delete;
+
+    bool load_file(const std::string& path) {
+        JsonValue config;
+        if (!JsonParser::parse_file(path, &config, &error_)) {
+            LOG(ERROR) << "load pipeline " << error_;
+            return false;
+        }
+        if (!load(config)) {
+            error_ = path + ": " + error_;
+            LOG(ERROR) << "load pipeline " << error_;
+            return false;
+        }
+        LOG(INFO) << "load pipeline " << path << ": " << nodes_.size() << " nodes";
+        return true;
+    }
+
+    bool load(const JsonValue& config) {
+        CHECK(nodes_.empty()) << "pipeline is already loaded!";
+
+        std::vector<NodeConfig> configs;
+        std::vector<int> order;
+        if (!parse(config, configs) || !validate(configs, order)) {
+            return false;
+        }
+        return build(configs, order);
+    }
+
+    //在代码里搭建拓扑时由PipeGraph接管节点，按接管的逆序析构，根节点要最先接管
+    template<typename T>
+    T* adopt(T* node) {
+        CHECK(!nodes_.empty() || (dynamic_cast<RootNode*>(node) != nullptr)) << node->name() << " must be adopted after the root node!";
+        if (nodes_.empty()) {
+            root_ = dynamic_cast<RootNode*>(node);
+        }
+        nodes_.push_back(std::unique_ptr<PipeNode>(node));
+        node_map_[node->name()] = node;
+        return node;
+    }
+
+    RootNode* root() {
+        return root_;
+    }
+
+    PipeNode* node(const std::string& name) {
+        auto it = node_map_.find(name);
+        return (it != node_map_.end()) ? it->second : nullptr;
+    }
+
+    //按名字取某个具体类型的节点，类型不符时返回空
+    template<typename T>
+    T* node_as(const std::string& name) {
+        return dynamic_cast<T*>(node(name));
+    }
+
+    //节点按上游在前的顺序
+    std::vector<PipeNode*> nodes() {
+        std::vector<PipeNode*> nodes;
+        for (auto& node : nodes_) {
+            nodes.push_back(node.get());
+        }
+        return nodes;
+    }
+
+    const std::string& error() {
+        return error_;
+    }
+
+    static bool parse_edge_policy(const std::string& name, int* policy) {
+        for (int i = EDGE_SHARED; i <= EDGE_LATEST_ONLY; i++) {
+            if (PipeEdge<PipeData>::policy_name(i) == name) {
+                *policy = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool parse_deadline_policy(const std::string& name, int* policy) {
+        static const char* names[] = {"ignore", "drop", "pass"};
+        static const int policies[] = {DEADLINE_IGNORE, DEADLINE_DROP, DEADLINE_PASS};
+        for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+            if (name == names[i]) {
+                *policy = policies[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool parse_buff_type(const std::string& name, int* buff_type) {
+        static const char* names[] = {"mutex", "lockfree", "broadcast"};
+        static const int types[] = {PIPE_BUFF_MUTEX, PIPE_BUFF_LOCKFREE, PIPE_BUFF_BROADCAST};
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (name == names[i]) {
+                *buff_type = types[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+protected:
+    bool fail(const std::string& message) {
+        error_ = message;
+        return false;
+    }
+
+    //对象里只能有keys里的字段，拼错的字段名直接报错，不会被悄悄忽略
+    bool check_keys(const JsonValue& value, const std::string& where, const std::set<std::string>& keys) {
+        for (const auto& member : value.members()) {
+            if (!keys.count(member.first)) {
+                return fail(where + ": unknown field \"" + member.first + "\"");
+            }
+        }
+        return true;
+    }
+
+    //检查字段的类型，不存在的可选字段直接通过
+    bool expect(const JsonValue& value, const std::string& where, const std::string& key, int type) {
+        if (!value.has(key) || (value[key].type() == type)) {
+            return true;
+        }
+        return fail(where + "." + key + " must be " + JsonValue::type_name(type) + ", got " + JsonValue::type_name(value[key].type()));
+    }
+
+    bool parse_sched(const JsonValue& value, const std::string& where, SchedPolicy* sched) {
+        static const std::set<std::string> keys = {"cpus", "policy", "priority", "nice", "numa"};
+        if (!check_keys(value, where, keys)) {
+            return false;
+        }
+        if (!expect(value, where, "cpus", JSON_ARRAY) || !expect(value, where, "policy", JSON_STRING) || !expect(value, where, "priority", JSON_NUMBER)
+            || !expect(value, where, "nice", JSON_NUMBER) || !expect(value, where, "numa", JSON_NUMBER)) {
+            return false;
+        }
+
+        for (const auto& cpu : value["cpus"].elements()) {
+            if (!cpu.is_number() || (cpu.as_int() < 0)) {
+                return fail(where + ".cpus must be cpu numbers");
+            }
+            sched->cpus.push_back((int)cpu.as_int());
+        }
+        std::string policy = value["policy"].as_string("other");
+        if (policy == "other") {
+            sched->policy = SCHED_OTHER;
+        } else if (policy == "fifo") {
+            sched->policy = SCHED_FIFO;
+        } else if (policy == "rr") {
+            sched->policy = SCHED_RR;
+        } else {
+            return fail(where + ".policy must be other, fifo or rr, got " + policy);
+        }
+        sched->priority = (int)value["priority"].as_int(0);
+        sched->nice = (int)value["nice"].as_int(0);
+        sched->numa_node = (int)value["numa"].as_int(-1);
+        return true;
+    }
+
+    bool parse_node(const JsonValue& value, const std::string& where, NodeConfig* config) {
+        static const std::set<std::string> keys = {"name", "type", "parent", "buff_num", "buff_type", "period_us", "spin_us", "edge", "pool", "sched", "replicas",
+            "latency_budget_us", "deadline", "params"};
+        if (!value.is_object()) {
+            return fail(where + " must be an object");
+        }
+        if (!check_keys(value, where, keys)) {
+            return false;
+        }
+        if (!value["name"].is_string() || value["name"].as_string().empty()) {
+            return fail(where + ".name is required");
+        }
+        if (!value["type"].is_string()) {
+            return fail(where + ".type is required");
+        }
+        if (!expect(value, where, "parent", JSON_STRING) || !expect(value, where, "buff_num", JSON_NUMBER) || !expect(value, where, "buff_type", JSON_STRING)
+            || !expect(value, where, "period_us", JSON_NUMBER) || !expect(value, where, "spin_us", JSON_NUMBER) || !expect(value, where, "pool", JSON_OBJECT)
+            || !expect(value, where, "sched", JSON_OBJECT) || !expect(value, where, "latency_budget_us", JSON_NUMBER)
+            || !expect(value, where, "deadline", JSON_STRING) || !expect(value, where, "params", JSON_OBJECT)) {
+            return false;
+        }
+
+        config->name = value["name"].as_string();
+        config->type = value["type"].as_string();
+        config->parent = value["parent"].as_string();
+        config->buff_num = (int)value["buff_num"].as_int(config->buff_num);
+        if (config->buff_num < 1) {
+            return fail(where + ".buff_num must be >= 1");
+        }
+        if (value.has("buff_type") && !parse_buff_type(value["buff_type"].as_string(), &config->buff_type)) {
+            return fail(where + ".buff_type must be mutex, lockfree or broadcast");
+        }
+        config->period_us = (long)value["period_us"].as_int(config->period_us);
+        config->spin_us = (long)value["spin_us"].as_int(config->spin_us);
+
+        //"edge": "latest_only" 或者 "edge": {"policy": "lossless", "deep": 8}
+        const JsonValue& edge = value["edge"];
+        if (!edge.is_null()) {
+            static const std::set<std::string> edge_keys = {"policy", "deep"};
+            if (edge.is_object() && !check_keys(edge, where + ".edge", edge_keys)) {
+                return false;
+            }
+            const JsonValue& policy = edge.is_object() ? edge["policy"] : edge;
+            if (!parse_edge_policy(policy.as_string(), &config->edge_policy)) {
+                return fail(where + ".edge policy must be shared, lossless, drop_oldest, drop_newest or latest_only");
+            }
+            config->edge_deep = (int)edge["deep"].as_int(-1);
+        }
+
+        const JsonValue& pool = value["pool"];
+        if (!pool.is_null()) {
+            static const std::set<std::string> pool_keys = {"block_size", "block_num"};
+            if (!check_keys(pool, where + ".pool", pool_keys)) {
+                return false;
+            }
+            if ((pool["block_size"].as_int() <= 0) || (pool["block_num"].as_int() <= 0)) {
+                return fail(where + ".pool needs block_size and block_num > 0");
+            }
+            config->pool_block_size = pool["block_size"].as_int();
+            config->pool_block_num = pool["block_num"].as_int();
+        }
+
+        if (value.has("sched")) {
+            config->has_sched = true;
+            if (!parse_sched(value["sched"], where + ".sched", &config->sched)) {
+                return false;
+            }
+        }
+        //"replicas": 3 或者 "replicas": {"num": 3, "dispatch": "least_loaded", "window": 8, "timeout_us": 100000}
+        const JsonValue& replicas = value["replicas"];
+        if (!replicas.is_null() && !parse_replicas(replicas, where + ".replicas", config)) {
+            return false;
+        }
+
+        config->latency_budget_us = value["latency_budget_us"].as_int(0);
+        if (value.has("deadline")) {
+            config->has_deadline = true;
+            if (!parse_deadline_policy(value["deadline"].as_string(), &config->deadline_policy)) {
+                return fail(where + ".deadline must be ignore, drop or pass");
+            }
+        }
+        config->params = value["params"];
+        return true;
+    }
+
+    bool parse_replicas(const JsonValue& value, const std::string& where, NodeConfig* config) {
+        static const std::set<std::string> keys = {"num", "dispatch", "window", "timeout_us"};
+        if (!value.is_number() && !value.is_object()) {
+            return fail(where + " must be a number or an object");
+        }
+        if (!check_keys(value, where, keys)) {
+            return false;
+        }
+        config->replica_num = (int)(value.is_number() ? value.as_int() : value["num"].as_int(1));
+        if (config->replica_num < 1) {
+            return fail(where + " num must be >= 1");
+        }
+        std::string dispatch = value["dispatch"].as_string("round_robin");
+        if (dispatch == "round_robin") {
+            config->replica_dispatch = REPLICA_ROUND_ROBIN;
+        } else if (dispatch == "least_loaded") {
+            config->replica_dispatch = REPLICA_LEAST_LOADED;
+        } else {
+            return fail(where + ".dispatch must be round_robin or least_loaded, got " + dispatch);
+        }
+        int64_t window = value["window"].as_int(0);
+        if (window < 0) {
+            return fail(where + ".window must be >= 0");
+        }
+        config->replica_window = window;
+        config->replica_timeout_us = value["timeout_us"].as_int(-1);
+        return true;
+    }
+
+    bool parse(const JsonValue& config, std::vector<NodeConfig>& configs) {
+        if (!config.is_object() || !config["nodes"].is_array() || (config["nodes"].size() == 0)) {
+            return fail("config needs a non-empty \"nodes\" array");
+        }
+        const JsonValue& nodes = config["nodes"];
+        configs.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (!parse_node(nodes[i], "nodes[" + std::to_string(i) + "]", &configs[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //检查整张图，order返回上游在前的创建顺序
+    bool validate(const std::vector<NodeConfig>& configs, std::vector<int>& order) {
+        std::map<std::string, int> index;
+        int root = -1;
+        for (size_t i = 0; i < configs.size(); i++) {
+            const NodeConfig& config = configs[i];
+            if (index.count(config.name)) {
+                return fail("duplicate node name " + config.name);
+            }
+            index[config.name] = (int)i;
+            if (!NodeFactory::instance().has(config.type)) {
+                return fail(config.name + ": unknown node type " + config.type);
+            }
+            if (config.parent.empty()) {
+                if (root >= 0) {
+                    return fail("more than one root: " + configs[root].name + " and " + config.name);
+                }
+                root = (int)i;
+            }
+        }
+        if (root < 0) {
+            return fail("no root node (a node without parent)");
+        }
+        if (configs[root].edge_policy != EDGE_SHARED) {
+            return fail(configs[root].name + ": root node can't have an input edge");
+        }
+
+        std::vector<std::vector<int> > children(configs.size());
+        for (size_t i = 0; i < configs.size(); i++) {
+            const NodeConfig& config = configs[i];
+            if (config.parent.empty()) {
+                continue;
+            }
+            auto it = index.find(config.parent);
+            if (it == index.end()) {
+                return fail(config.name + ": orphan, parent " + config.parent + " not found");
+            }
+            if (it->second == (int)i) {
+                return fail(config.name + ": cycle, node is its own parent");
+            }
+            if (configs[i].pool_block_num > 0) {
+                return fail(config.name + ": only the root node can have a buffer pool");
+            }
+            if (configs[i].latency_budget_us > 0) {
+                return fail(config.name + ": only the root node can have a latency budget");
+            }
+            children[it->second].push_back((int)i);
+        }
+
+        //从根开始广度优先，到不了的节点都在环上或者挂在环下面
+        std::vector<bool> reached(configs.size(), false);
+        order.push_back(root);
+        reached[root] = true;
+        for (size_t i = 0; i < order.size(); i++) {
+            for (int child : children[order[i]]) {
+                reached[child] = true;
+                order.push_back(child);
+            }
+        }
+        if (order.size() == configs.size()) {
+            return true;
+        }
+
+        for (size_t i = 0; i < configs.size(); i++) {
+            if (reached[i]) {
+                continue;
+            }
+            //沿着parent往上走，回到走过的节点就是环
+            std::vector<int> path;
+            std::set<int> visited;
+            int node = (int)i;
+            while(!visited.count(node)) {
+                visited.insert(node);
+                path.push_back(node);
+                node = index[configs[node].parent];
+            }
+            std::string cycle = configs[node].name;
+            for (size_t j = std::find(path.begin(), path.end(), node) - path.begin() + 1; j < path.size(); j++) {
+                cycle += " -> " + configs[path[j]].name;
+            }
+            return fail(configs[i].name + ": unreachable from root " + configs[root].name + ", cycle " + cycle + " -> " + configs[node].name);
+        }
+        return true;
+    }
+
+    bool build(const std::vector<NodeConfig>& configs, const std::vector<int>& order) {
+        std::vector<std::unique_ptr<PipeNode> > nodes;
+        for (int i : order) {
+            const NodeConfig& config = configs[i];
+            std::unique_ptr<PipeNode> node(NodeFactory::instance().create(config));
+            if (!node) {
+                return fail(config.name + ": create node type " + config.type + " failed");
+            }
+            if (config.parent.empty() != (dynamic_cast<RootNode*>(node.get()) != nullptr)) {
+                return fail(config.name + ": node type " + config.type + (config.parent.empty() ? " can't be a root" : " must be the root"));
+            }
+
+            node->set_buff_type(config.buff_type);
+            if (config.has_sched) {
+                node->set_sched_policy(config.sched);
+            }
+            FilterNode* filter = dynamic_cast<FilterNode*>(node.get());
+            if (filter) {
+                filter->set_spin_us(config.spin_us);
+                filter->set_replicas(config.replica_num, config.replica_dispatch, config.replica_window, config.replica_timeout_us);
+                filter->set_deadline_policy(config.deadline_policy);
+            } else if (config.replica_num > 1) {
+                return fail(config.name + ": node type " + config.type + " can't run replicas");
+            } else if (config.has_deadline) {
+                return fail(config.name + ": node type " + config.type + " has no deadline policy");
+            }
+            RootNode* root = dynamic_cast<RootNode*>(node.get());
+            if (root && (config.pool_block_num > 0)) {
+                root->set_pool(config.pool_block_size, config.pool_block_num);
+            }
+            if (root) {
+                root->set_latency_budget_us(config.latency_budget_us);
+            }
+            nodes.push_back(std::move(node));
+        }
+
+        //全部创建成功后再连接
+        std::map<std::string, PipeNode*> node_map;
+        for (auto& node : nodes) {
+            node_map[node->name()] = node.get();
+        }
+        for (size_t i = 1; i < order.size(); i++) {
+            const NodeConfig& config = configs[order[i]];
+            node_map[config.parent]->append(nodes[i].get(), config.edge_policy, config.edge_deep);
+        }
+
+        root_ = dynamic_cast<RootNode*>(nodes[0].get());
+        nodes_.swap(nodes);
+        node_map_.swap(node_map);
+        return true;
+    }
+
+protected:
+    std::vector<std::unique_ptr<PipeNode> > nodes_;
+    std::map<std::string, PipeNode*> node_map_;
+    RootNode* root_;
+    std::string error_;
+};
+
+
+}//namespace thread
+}//namespace duck
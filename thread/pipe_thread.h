@@ -8,141 +8,602 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <vector>
+#include <deque>
+#include <algorithm>
 
 #include "thread/thread.h" 
 #include "thread/queue.h"
 #include "thread/ringbuffer.h"
+#include "thread/pipe_buffer.h"
+#include "thread/pipe_edge.h"
+#include "thread/buffer_pool.h"
+#include "thread/executor.h"
+#include "thread/replica_set.h"
+#include "thread/latch.h"
+#include "thread/metrics.h"
+#include "thread/trace_recorder.h"
+#include "timer/timer_manager.h"
 
 namespace duck {
 namespace thread {
 
 
+#ifndef DUCK_PIPE_MAX_STAMPS
+#define DUCK_PIPE_MAX_STAMPS 16
+#endif
+
+//一个节点处理一帧的时间戳，全部是steady_clock的纳秒。
+//dequeue: 从上游取到数据，start/end: compute()前后，enqueue: 放进自己的输出缓冲。
+//节点用16位的id表示，名字通过register_node()登记，只在打印时查找。
+//节点析构时id还回来给后面的节点复用，node_gen区分同一个id的前后几个节点。
 class PipeStamp
 {
 public:
-    PipeStamp(const std::string& name, size_t pipe_data_id) : thread_name_(name), pipe_data_id_(pipe_data_id) {}
+    PipeStamp(uint16_t node_id = 0, uint16_t node_gen = 0) : node_id_(node_id), node_gen_(node_gen), dequeue_ns_(0), start_ns_(0), end_ns_(0), enqueue_ns_(0) {}
 
-    void record_now() { 
+    static int64_t now_ns() {
+        auto now = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    }
 
-        // 获取当前时间点
-        auto now = std::chrono::high_resolution_clock::now();
+    void record_dequeue() {
+        dequeue_ns_ = now_ns();
+    }
 
-        // 将时间点转换为微秒
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch());
+    void record_start() {
+        start_ns_ = now_ns();
+    }
+
+    void record_end() {
+        end_ns_ = now_ns();
+    }
+
+    void record_enqueue() {
+        enqueue_ns_ = now_ns();
+    }
+
+    int64_t dequeue_ns() {
+        return dequeue_ns_;
+    }
+
+    int64_t start_ns() {
+        return start_ns_;
+    }
 
-        // 获取微秒值
-        long long us = duration.count();
+    int64_t end_ns() {
+        return end_ns_;
+    }
 
-        us_vec_.push_back(us & 0xffffffff);
+    int64_t enqueue_ns() {
+        return enqueue_ns_;
     }
 
+    //compute()耗时
+    int64_t compute_ns() {
+        return end_ns_ - start_ns_;
+    }
 
-    float time_ms(size_t id) {
-        CHECK(id < us_vec_.size()) << "PipeStamp don't record this id time!";
-        long us = us_vec_[id]; 
-        float ms = (float)us / 1000.0;
-        return ms;
+    //在上游输出缓冲里等待的时间
+    int64_t queue_ns(PipeStamp& prev) {
+        return dequeue_ns_ - prev.enqueue_ns_;
     }
 
-    float start_ms() {
-        return time_ms(0);
+    double start_ms() {
+        return start_ns_ / 1000000.0;
     }
     
-    float end_ms() {
-        return time_ms(1);
+    double end_ms() {
+        return end_ns_ / 1000000.0;
     }
 
-    float duration_ms(size_t start_id = 0, size_t end_id = 1) {
- 
-        float start = time_ms(start_id);
-        float end = time_ms(end_id);
-        return (end > start) ? (end - start) : (start - end);
+    float duration_ms() {
+        return compute_ns() / 1000000.0;
+    }
+
+    uint16_t node_id() {
+        return node_id_;
+    }
+
+    uint16_t node_gen() {
+        return node_gen_;
     }
 
     std::string name() {
-        return thread_name_;
+        return node_name(node_id_, node_gen_);
+    }
+
+    //0xffff留给TraceRecorder::kNoNode，同时存在的节点最多0xffff个。
+    //先分配没用过的id，用完了才复用release_node()还回来的，复用时代数加1，
+    //这样反复创建销毁的节点(viewer、MuxInput)不会把id耗尽，旧的时间戳和轨迹也不会查到新节点的名字
+    static uint16_t register_node(const std::string& name, uint16_t& node_gen) {
+        std::unique_lock<std::mutex> lock(names_mutex());
+        NodeRegistry& registry = node_registry();
+        uint16_t node_id;
+        if (registry.slots.size() < 0xffff) {
+            node_id = registry.slots.size();
+            registry.slots.push_back(NodeSlot());
+        } else {
+            CHECK(!registry.free_ids.empty()) << "too many pipe node!";
+            node_id = registry.free_ids.front();
+            registry.free_ids.pop_front();
+            registry.slots[node_id].node_gen++;
+        }
+        registry.slots[node_id].name = name;
+        node_gen = registry.slots[node_id].node_gen;
+        return node_id;
     }
 
-    size_t pipe_data_id() {
-        return pipe_data_id_;
+    //名字保留到id被复用为止，节点析构之后导出的轨迹还能查到
+    static void release_node(uint16_t node_id) {
+        std::unique_lock<std::mutex> lock(names_mutex());
+        node_registry().free_ids.push_back(node_id);
+    }
+
+    static std::string node_name(uint16_t node_id, uint16_t node_gen) {
+        std::unique_lock<std::mutex> lock(names_mutex());
+        NodeRegistry& registry = node_registry();
+        if (node_id < registry.slots.size() && registry.slots[node_id].node_gen == node_gen) {
+            return registry.slots[node_id].name;
+        }
+        return std::string("unknown");
     }
 
 protected:
-    std::string thread_name_;
-    size_t pipe_data_id_; 
-    std::vector<long> us_vec_;
+    struct NodeSlot
+    {
+        NodeSlot() : node_gen(0) {}
+        std::string name;
+        uint16_t node_gen;
+    };
+
+    struct NodeRegistry
+    {
+        std::vector<NodeSlot> slots;
+        std::deque<uint16_t> free_ids;
+    };
+
+    static std::mutex& names_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static NodeRegistry& node_registry() {
+        static NodeRegistry registry;
+        return registry;
+    }
+
+protected:
+    uint16_t node_id_;
+    uint16_t node_gen_;
+    int64_t dequeue_ns_;
+    int64_t start_ns_;
+    int64_t end_ns_;
+    int64_t enqueue_ns_;
 };
 
 class PipeData
 {
 public: 
-    PipeData(size_t pipe_data_id = 0, bool quit = false) :  pipe_data_id_(pipe_data_id), quit_(quit) {}
+    PipeData(size_t pipe_data_id = 0, bool quit = false) :  pipe_data_id_(pipe_data_id), quit_(quit), stream_id_(0), stamp_num_(0), stamp_dropped_(0),
+        capture_ns_(0), budget_ns_(0) {}
 
     size_t pipe_data_id() {
         return pipe_data_id_;
     }
 
-    void push_stamp(PipeStamp stamp) {
-        pipe_stamp_vec_.push_back(stamp);
+    //时间戳存在PipeData内部的定长数组里，超出DUCK_PIPE_MAX_STAMPS的节点不再记录
+    PipeStamp* push_stamp(const PipeStamp& stamp) {
+        if (stamp_num_ >= DUCK_PIPE_MAX_STAMPS) {
+            stamp_dropped_++;
+            return nullptr;
+        }
+        stamps_[stamp_num_] = stamp;
+        return &stamps_[stamp_num_++];
+    }
+
+    size_t stamp_num() {
+        return stamp_num_;
+    }
+
+    PipeStamp& stamp(size_t index) {
+        CHECK(index < stamp_num_) << "PipeData don't have stamp " << index;
+        return stamps_[index];
     }
 
-    std::vector<PipeStamp >& pipe_stamp_vec() {
-        return pipe_stamp_vec_;
+    PipeStamp* back_stamp() {
+        return (stamp_num_ > 0) ? &stamps_[stamp_num_ - 1] : nullptr;
     }
 
-    bool quit() {
+    //图像/码流数据，多个PipeData拷贝共享同一块缓冲，不做memcpy
+    BufferRef& payload() {
+        return payload_;
+    }
+
+    void set_payload(const BufferRef& payload) {
+        payload_ = payload;
+    }
+
+    bool quit() const {
         return quit_;
     }
 
-    float latency_ms() {
-        if (pipe_stamp_vec_.empty()) {
+    void set_quit(bool quit) {
+        quit_ = quit;
+    }
+
+    //多路复用时区分是哪一路源产生的，pipe_data_id只在同一路内有序
+    uint16_t stream_id() const {
+        return stream_id_;
+    }
+
+    void set_stream_id(uint16_t stream_id) {
+        stream_id_ = stream_id;
+    }
+
+    //采集时间，steady_clock的纳秒。源节点的compute()可以填传感器的时间戳，没有填时用源节点开始处理的时间
+    int64_t capture_ns() const {
+        return capture_ns_;
+    }
+
+    void set_capture_ns(int64_t capture_ns) {
+        capture_ns_ = capture_ns;
+    }
+
+    //端到端延迟的起点：有采集时间时用采集时间，和截止时间的起点一致，否则用源节点开始处理的时间
+    int64_t origin_ns() {
+        if (capture_ns_ > 0) {
+            return capture_ns_;
+        }
+        return (stamp_num_ > 0) ? stamps_[0].start_ns() : 0;
+    }
+
+    //从采集开始的端到端延迟预算，<= 0表示不限
+    int64_t latency_budget_ns() const {
+        return budget_ns_;
+    }
+
+    void set_latency_budget_ns(int64_t budget_ns) {
+        budget_ns_ = budget_ns;
+    }
+
+    //必须处理完的时间点，0表示没有截止时间
+    int64_t deadline_ns() const {
+        return ((budget_ns_ > 0) && (capture_ns_ > 0)) ? (capture_ns_ + budget_ns_) : 0;
+    }
+
+    //从源节点开始处理到最后一个节点处理完的时间
+    int64_t latency_ns() {
+        if (stamp_num_ == 0) {
             return 0;
         }
+        return stamps_[stamp_num_ - 1].end_ns() - stamps_[0].start_ns();
+    }
 
-        float start = pipe_stamp_vec_.front().start_ms();
-        float end = pipe_stamp_vec_.back().end_ms();
-        return (end - start);
+    float latency_ms() {
+        return latency_ns() / 1000000.0;
     }
 
     void show() {
-        for (size_t i = 0; i < pipe_stamp_vec_.size(); i++) {
-            PipeStamp& stamp = pipe_stamp_vec_[i];
-            LOG(INFO)<< std::fixed << std::setprecision(3) << i << "\t thread: " << stamp.name() << "\t id: " << stamp.pipe_data_id() 
-                << "\t start: " << stamp.start_ms() << "\t end: " << stamp.end_ms() << "\t duration: " << stamp.duration_ms();
+        for (size_t i = 0; i < stamp_num_; i++) {
+            PipeStamp& stamp = stamps_[i];
+            int64_t queue_ns = (i > 0) ? stamp.queue_ns(stamps_[i - 1]) : 0;
+            LOG(INFO)<< std::fixed << std::setprecision(3) << i << "\t thread: " << stamp.name() << "\t id: " << pipe_data_id_
+                << "\t start: " << stamp.start_ms() << "\t end: " << stamp.end_ms() << "\t duration: " << stamp.duration_ms()
+                << "\t queue: " << queue_ns / 1000000.0;
         }
     }
 
 protected:
     size_t pipe_data_id_;
-    std::vector<PipeStamp > pipe_stamp_vec_;
     bool quit_;
+    uint16_t stream_id_;
+    uint16_t stamp_num_;
+    uint16_t stamp_dropped_;
+    PipeStamp stamps_[DUCK_PIPE_MAX_STAMPS];
+    BufferRef payload_;
+    int64_t capture_ns_;
+    int64_t budget_ns_;
 };
 
 
-class PipeNode : public Thread
+//节点的生命周期：start()之后RUNNING，stop()开始排空时DRAINING，线程/任务退出后STOPPED，可以再次start()
+enum NodeState
+{
+    NODE_INIT = 0,
+    NODE_RUNNING,
+    NODE_DRAINING,
+    NODE_STOPPED,
+};
+
+//帧已经赶不上截止时间时FilterNode的处理方式
+enum DeadlinePolicy
+{
+    DEADLINE_IGNORE = 0,    //照常处理
+    DEADLINE_DROP,          //不处理也不交给下游
+    DEADLINE_PASS,          //不调用compute()，原样交给下游
+};
+
+class PipeNode : public Thread, public MetricsSource
 {
 public:
-    PipeNode(const std::string& node_name, int buff_num) : Thread(node_name), buff_(buff_num), pre_node_(nullptr), level_(0) {
+    static const int kDrainTimeoutMs = 3000;
 
-    }
+    typedef std::vector<PipeNode*> NodeList;
 
-    virtual PipeNode* append(PipeNode* node) {
+    //子节点列表的读端(RCU)：登记为读者后取当前发布的列表，析构时注销。
+    //持有期间列表不会被回收，读取不加锁，put_data()每帧只多一对原子加减。
+    //读者登记在当前epoch的计数上，写者切换epoch后只等旧计数归零，连续不断的读者不会让写者一直等下去
+    class ChildrenRef
+    {
+    public:
+        explicit ChildrenRef(PipeNode* node) : node_(node) {
+            epoch_ = node_->epoch_.load();
+            node_->readers_[epoch_].fetch_add(1);
+            list_ = node_->children_.load();
+        }
+
+        ~ChildrenRef() {
+            node_->readers_[epoch_].fetch_sub(1, std::memory_order_release);
+        }
+
+        NodeList::const_iterator begin() const {
+            return list_->begin();
+        }
+
+        NodeList::const_iterator end() const {
+            return list_->end();
+        }
+
+        bool empty() const {
+            return list_->empty();
+        }
+
+    protected:
+        PipeNode* node_;
+        int epoch_;
+        const NodeList* list_;
+    };
+
+    PipeNode(const std::string& node_name, int buff_num, int buff_type = PIPE_BUFF_MUTEX) 
+        : Thread(node_name), pre_node_(nullptr), buff_num_(buff_num), buff_type_(buff_type), level_(0), executor_(nullptr), timer_(nullptr),
+        state_(NODE_INIT), quit_requested_(false), abort_(false), start_latch_(nullptr), stop_latch_(nullptr),
+        children_(new NodeList), epoch_(0) {
+        node_id_ = PipeStamp::register_node(node_name, node_gen_);
+        readers_[0].store(0);
+        readers_[1].store(0);
+        buff_.reset(create_pipe_buffer<PipeData>(buff_type_, buff_num_, node_name));
+    }
+
+    //重写了collect_metrics()的子类要在自己的析构函数开头先退出登记，到这里派生部分已经析构了
+    virtual ~PipeNode() {
+        MetricsRegistry::instance().remove(this);
+        delete children_.load();
+        PipeStamp::release_node(node_id_);
+    }
+
+    //切换输出缓冲的实现，只能在start()之前调用
+    void set_buff_type(int buff_type) {
+        CHECK(!is_running()) << name() << " can't change buffer type while running!";
+        std::unique_ptr<PipeBuffer<PipeData> > buff(create_pipe_buffer<PipeData>(buff_type, buff_num_, name()));
+        std::unique_lock<std::mutex> lock(metrics_mutex_);
+        buff_type_ = buff_type;
+        buff_.swap(buff);
+    }
+
+    int buff_type() {
+        return buff_type_;
+    }
+
+    //edge_policy选择这条边的投递方式，除EDGE_SHARED外下游有自己的有界队列，edge_deep <= 0时使用本节点的缓冲深度。
+    //本节点运行中也可以调用：新分支先启动，再发布到子节点列表，从下一个pipe_data_id开始收到数据，上游不停顿。
+    //EDGE_LOSSLESS满了会阻塞本节点，本节点正作为executor任务运行时不能接无损的边，要先stop()
+    virtual PipeNode* append(PipeNode* node, int edge_policy = EDGE_SHARED, int edge_deep = -1) {
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        CHECK(!node->pre_node_) << node->name() << " is already attached to " << node->pre_node_->name();
+        CHECK(!((edge_policy == EDGE_LOSSLESS) && (state_.load() == NODE_RUNNING) && is_task()))
+            << name() << " is running as an executor task and can't block on a lossless edge to " << node->name();
         node->set_pre_node(this); 
         node->inc_level(level());
-        next_node_list_.push_back(node); 
+        node->set_input_edge(edge_policy, (edge_deep > 0) ? edge_deep : buff_num_);
+        if (executor_ && !node->executor()) {
+            node->set_executor(executor_, timer_);
+        }
+
+        bool live = (state_.load() == NODE_RUNNING);
+        if (live) {
+            node->start();
+        }
+
+        NodeList* list = new NodeList(*children_.load());
+        list->push_back(node);
+        publish_children(list);
+        if (live) {
+            LOG(INFO) << name() << " attach " << node->name() << " at seq " << output_seq();
+        }
         return node;
     }
 
-    void put_data(PipeData pipe_data) {
-        buff_.put(pipe_data);
+    //摘下一个分支：先排空并停止子树(和stop()相同)，再从子节点列表里去掉。
+    //返回后本节点不会再访问node，node可以挂到别处或者析构
+    bool detach(PipeNode* node, int64_t drain_timeout_ms = kDrainTimeoutMs) {
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        NodeList* list = new NodeList(*children_.load());
+        auto it = std::find(list->begin(), list->end(), node);
+        if (it == list->end()) {
+            LOG(WARNING) << node->name() << " is not a child of " << name();
+            delete list;
+            return false;
+        }
+
+        bool drained = node->stop(drain_timeout_ms);
+        //子树可能在stop()之前就自己退出了，这里确保线程都已经结束
+        node->finish_stop();
+        list->erase(it);
+        publish_children(list);
+        node->release_input();
+        node->set_pre_node(nullptr);
+        node->inc_level(-1);
+        LOG(INFO) << name() << " detach " << node->name() << " at seq " << output_seq();
+        return drained;
+    }
+
+    //退出帧在任何策略下都不会被丢弃，保证下游能收到
+    void put_data(const PipeData& pipe_data) {
+        buff_->put(pipe_data);
+        if (!pipe_data.quit()) {
+            metrics_.on_output();
+        }
+        for (const auto node : ChildrenRef(this)) {
+            node->deliver(pipe_data);
+        }
+    }
+
+    //节点启动过就一直登记在指标里，停下摘掉后再append()到运行中的图上时采集线程可能正在读旧的边，替换要和collect_metrics()互斥
+    virtual void set_input_edge(int edge_policy, int edge_deep) {
+        CHECK(!is_running()) << name() << " can't change input edge while running!";
+        std::unique_ptr<PipeEdge<PipeData> > edge;
+        if (edge_policy != EDGE_SHARED) {
+            edge.reset(new PipeEdge<PipeData>(edge_policy, edge_deep, name() + "_input"));
+        }
+        std::unique_lock<std::mutex> lock(metrics_mutex_);
+        input_edge_.swap(edge);
+    }
+
+    //输入边，EDGE_SHARED时为空
+    PipeEdge<PipeData>* input_edge() {
+        return input_edge_.get();
+    }
+
+    bool try_get_data(ReadCursor& cursor, PipeData* pipe_data) {
+        return buff_->try_get_sync(cursor, pipe_data);
+    }
+
+    bool try_get_data_async(ReadCursor& cursor, PipeData* pipe_data) {
+        return buff_->try_get_async(cursor, pipe_data);
+    }
+
+    //下游不再用这个游标读本节点的输出，还回在缓冲上登记的编号
+    void release_cursor(ReadCursor& cursor) {
+        buff_->unsubscribe(cursor);
+    }
+
+    //上游节点发布了新数据
+    virtual void on_input() {}
+
+    //本节点是否作为executor上的任务运行，没有自己的线程
+    virtual bool is_task() {
+        return false;
+    }
+
+    //从上游摘下或者重新启动前，释放在上游缓冲上的登记
+    virtual void release_input() {}
+
+protected:
+    //上游把一帧交给本节点：有输入边时放进边里，然后通知
+    virtual void deliver(const PipeData& pipe_data) {
+        if (input_edge_) {
+            input_edge_->put(pipe_data, pipe_data.quit());
+        }
+        on_input();
+    }
+
+public:
+    //把本节点及其子树切换到线程池模式：节点不再独占线程，而是作为任务在executor上调度，
+    //拉模式节点由timer周期触发。RootNode仍然使用自己的线程产生数据。必须在start()之前调用。
+    void set_executor(Executor* executor, duck::timer::TimerManager* timer) {
+        CHECK(!is_running()) << name() << " can't change executor while running!";
+        executor_ = executor;
+        timer_ = timer;
+        for (const auto node : ChildrenRef(this)) {
+            node->set_executor(executor, timer);
+        }
+    }
+
+    Executor* executor() {
+        return executor_;
+    }
+
+    uint16_t node_id() {
+        return node_id_;
+    }
+
+    uint16_t node_gen() {
+        return node_gen_;
+    }
+
+    NodeMetrics& metrics() {
+        return metrics_;
+    }
+
+    //TraceRecorder打开时记录本节点处理这一帧的时间线，在stamp压入pipe_data之前调用
+    void trace(PipeData& pipe_data, PipeStamp& stamp) {
+        TraceRecorder& recorder = TraceRecorder::instance();
+        if (!recorder.enabled()) {
+            return;
+        }
+
+        TraceEvent event;
+        event.pipe_data_id = pipe_data.pipe_data_id();
+        event.stream_id = pipe_data.stream_id();
+        event.node_id = node_id_;
+        event.node_gen = node_gen_;
+        event.dequeue_ns = stamp.dequeue_ns();
+        event.start_ns = stamp.start_ns();
+        event.end_ns = stamp.end_ns();
+        PipeStamp* prev = pipe_data.back_stamp();
+        event.prev_node_id = prev ? prev->node_id() : TraceRecorder::kNoNode;
+        event.prev_node_gen = prev ? prev->node_gen() : 0;
+        event.prev_start_ns = prev ? prev->start_ns() : 0;
+        event.prev_enqueue_ns = prev ? prev->enqueue_ns() : 0;
+        recorder.record(event);
+    }
+
+    //MetricsSource接口，在采集线程里调用，只读原子变量。metrics_mutex_只和替换缓冲、输入边竞争，不在帧路径上
+    virtual void collect_metrics(NodeMetricsSnapshot& snapshot) {
+        snapshot.name = name();
+        snapshot.node_id = node_id_;
+        metrics_.snapshot(snapshot);
+        {
+            std::unique_lock<std::mutex> lock(metrics_mutex_);
+            snapshot.overwritten = (buff_ && !is_leaf()) ? buff_->overwritten() : 0;
+            if (input_edge_) {
+                snapshot.edge_policy = input_edge_->policy();
+                snapshot.dropped = input_edge_->dropped_count();
+                snapshot.edge_occupancy = input_edge_->occupancy();
+                snapshot.edge_blocked = input_edge_->blocked_count();
+            }
+        }
+
+        //积压按读共享缓冲的下游里最慢的算，不超过缓冲深度；有自己队列的下游看edge_occupancy
+        uint64_t published = metrics_.frames_out();
+        uint64_t depth = 0;
+        for (const auto node : ChildrenRef(this)) {
+            if (node->input_edge_) {
+                continue;
+            }
+            uint64_t seq = node->metrics().input_seq();
+            if (published > seq) {
+                depth = std::max(depth, published - seq);
+            }
+        }
+        snapshot.queue_depth = std::min(depth, (uint64_t)buff_num_);
     }
 
     PipeData get_data() {
-        return buff_.get_sync();
+        return buff_->get_sync();
     }
 
     PipeData get_data_async() {
-        return buff_.get_async();
+        return buff_->get_async();
+    }
+
+    PipeData get_data(ReadCursor& cursor) {
+        return buff_->get_sync(cursor);
+    }
+
+    PipeData get_data_async(ReadCursor& cursor) {
+        return buff_->get_async(cursor);
     }
 
     void set_pre_node(PipeNode* node) {
@@ -153,47 +614,120 @@ public:
         return pre_node_;
     }
 
+    //启动本节点和整个子树，所有节点都进入process()(或者挂到executor上)之后才返回
     virtual void start() {
-        for (const auto node : next_node_list_) {
-            node->start();
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        int state = state_.load();
+        if ((state == NODE_RUNNING) || (state == NODE_DRAINING)) {
+            LOG(WARNING) << name() << " is already running!";
+            return;
         }
 
-        Thread::start();
-        while(!is_running());
+        Latch latch(subgraph_size());
+        launch(&latch);
+        latch.wait();
     }
 
-    virtual void stop() {
-        for (const auto node : next_node_list_) {
-            node->stop();
+    //停止本节点和整个子树，可以只停一个分支，上游继续运行。
+    //本节点之后的数据都标记为退出帧，下游处理完队列里已有的数据后依次退出；
+    //drain_timeout_ms内没有全部退出时丢掉剩下的数据(不再调用compute())，唤醒子树里所有等输入的节点直接退出，返回false。
+    //中止后再等drain_timeout_ms还没退出的节点只能是卡在compute()里，只能等它返回
+    virtual bool stop(int64_t drain_timeout_ms = kDrainTimeoutMs) {
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        if (state_.load() != NODE_RUNNING) {
+            return true;
         }
-        join();
+
+        Latch latch(subgraph_size());
+        begin_drain(&latch);
+        quit_requested_.store(true);
+
+        bool drained = latch.wait_for(drain_timeout_ms);
+        if (!drained) {
+            LOG(WARNING) << name() << " drain timeout after " << drain_timeout_ms << "ms, drop in-flight frames!";
+            abort_drain();
+            if (!latch.wait_for(drain_timeout_ms)) {
+                LOG(ERROR) << name() << " still not quit after abort, wait compute() to return!";
+                latch.wait();
+            }
+        }
+        finish_stop();
+        return drained;
     }
 
+    int state() {
+        return state_.load();
+    }
+
+    static std::string state_name(int state) {
+        switch(state)
+        {
+            case NODE_INIT:
+                return "init";
+            case NODE_RUNNING:
+                return "running";
+            case NODE_DRAINING:
+                return "draining";
+            case NODE_STOPPED:
+                return "stopped";
+            default:
+                return std::to_string(state);
+        }
+    }
 
     bool is_child_quit() {
-        for (const auto node : next_node_list_) {
-            if (node->is_running()) {
+        for (const auto node : ChildrenRef(this)) {
+            int state = node->state();
+            if ((state == NODE_RUNNING) || (state == NODE_DRAINING)) {
                 return false;
             }
         }
         return true;
     }
 
+    //本节点输出缓冲最新的写序号
+    size_t output_seq() {
+        return buff_->wptr();
+    }
+
+    int subgraph_size() {
+        int size = 1;
+        for (const auto node : ChildrenRef(this)) {
+            size += node->subgraph_size();
+        }
+        return size;
+    }
+
+    //本节点和整个子树，上游在前
+    void collect_subtree(std::vector<PipeNode*>& nodes) {
+        nodes.push_back(this);
+        for (const auto node : ChildrenRef(this)) {
+            node->collect_subtree(nodes);
+        }
+    }
+
+    int buff_num() {
+        return buff_num_;
+    }
+
     void show() {
         std::stringstream ss;
         for (int i = 0; i < level(); i++) {
             ss << "\t";
         }
-        ss << "├── " << name();
+        ss << "├── " << name() << "  [" << ((executor_ && !is_root()) ? std::string("executor: ") + executor_->name() : placement()) << "]";
+        if (input_edge_) {
+            ss << "  <" << PipeEdge<PipeData>::policy_name(input_edge_->policy()) << " " << input_edge_->deep() << ">";
+        }
         std::cout << ss.str() << std::endl;
-        for (const auto node : next_node_list_) { 
+        for (const auto node : ChildrenRef(this)) { 
             node->show();
         }
     }
 
     void inc_level(int level) {
         level_ = level + 1;
-        for (const auto node : next_node_list_) {
+        for (const auto node : ChildrenRef(this)) {
             node->inc_level(level_);
         }
     }
@@ -208,46 +742,238 @@ public:
     }
 
     bool is_leaf() {
-        return next_node_list_.empty();
+        return ChildrenRef(this).empty();
     }
 
-    long now_us() {
-        auto now = std::chrono::high_resolution_clock::now();
+    int64_t now_us() {
+        auto now = std::chrono::steady_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch());
-        long us = duration.count() & 0xffffffff;
-        return us;
+        return duration.count();
+    }
+
+protected:
+    //先启动子树再启动自己，每个节点就绪时对latch倒数一次
+    virtual void launch(Latch* latch) {
+        launch_children(latch);
+        reset_state();
+        start_latch_.store(latch);
+        Thread::start();
+    }
+
+    void launch_children(Latch* latch) {
+        for (const auto node : ChildrenRef(this)) {
+            node->launch(latch);
+        }
+    }
+
+    //启动时才登记指标：构造函数里派生类还没构造完，采集线程这时调用虚函数collect_metrics()是不安全的
+    void reset_state() {
+        MetricsRegistry::instance().add(this);
+        quit_requested_.store(false);
+        abort_.store(false);
+        stop_latch_.store(nullptr);
+        if (input_edge_) {
+            input_edge_->clear();
+            input_edge_->reopen();
+        }
+        state_.store(NODE_RUNNING);
+    }
+
+    //线程进入process()时调用
+    void ready() {
+        Latch* latch = start_latch_.exchange(nullptr);
+        if (latch) {
+            latch->count_down();
+        }
+    }
+
+    //线程或者任务退出时调用，关闭输入边让阻塞在上面的上游退出等待
+    void exited() {
+        if (input_edge_) {
+            input_edge_->close();
+        }
+        state_.store(NODE_STOPPED);
+        //先通知上游再倒数，stop()返回后不再访问pre_node_
+        if (pre_node_) {
+            pre_node_->notify_child_exit();
+        }
+        Latch* latch = stop_latch_.exchange(nullptr);
+        if (latch) {
+            latch->count_down();
+        }
+    }
+
+    void notify_child_exit() {
+        std::unique_lock<std::mutex> lock(exit_mutex_);
+        exit_cond_.notify_all();
+    }
+
+    //等下游全部退出，超时返回false
+    bool wait_child_quit(int64_t timeout_ms) {
+        std::unique_lock<std::mutex> lock(exit_mutex_);
+        return exit_cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return is_child_quit(); });
+    }
+
+    void begin_drain(Latch* latch) {
+        //已经退出的节点直接倒数，exchange保证和exited()之间只有一方倒数
+        stop_latch_.store(latch);
+        int state = NODE_RUNNING;
+        if (!state_.compare_exchange_strong(state, NODE_DRAINING) && (state == NODE_STOPPED)) {
+            Latch* owned = stop_latch_.exchange(nullptr);
+            if (owned) {
+                owned->count_down();
+            }
+        }
+        for (const auto node : ChildrenRef(this)) {
+            node->begin_drain(latch);
+        }
+    }
+
+    //上游可能卡住或者已经停了，等输入的节点再也等不到退出帧，这里逐个唤醒：
+    //输入边里塞一个退出帧，读共享缓冲的唤醒上游缓冲上的读者(游标带着abort_)，executor上的任务重新调度
+    void abort_drain() {
+        abort_.store(true);
+        if (input_edge_) {
+            input_edge_->interrupt(PipeData(0, true));
+        } else if (pre_node_) {
+            pre_node_->buff_->wake();
+        }
+        on_input();
+        for (const auto node : ChildrenRef(this)) {
+            node->abort_drain();
+        }
+    }
+
+    virtual void finish_stop() {
+        for (const auto node : ChildrenRef(this)) {
+            node->finish_stop();
+        }
+        join();
+    }
+
+    //发布新的子节点列表，等还在读旧列表的线程离开后回收旧列表，调用者持有graph_mutex_。
+    //读者取epoch和登记之间可能隔着一次切换，所以两个计数都要等一遍
+    void publish_children(NodeList* list) {
+        NodeList* old = children_.exchange(list);
+        for (int i = 0; i < 2; i++) {
+            int epoch = epoch_.load();
+            epoch_.store(epoch ^ 1);
+            while(readers_[epoch].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+        delete old;
     }
 
 protected:
     PipeNode* pre_node_;
-    std::list<PipeNode*> next_node_list_;
-    RingBuffer<PipeData > buff_;
+    int buff_num_;
+    int buff_type_;
+    std::unique_ptr<PipeBuffer<PipeData> > buff_;
+    std::unique_ptr<PipeEdge<PipeData> > input_edge_;
+    std::mutex metrics_mutex_;              //替换buff_和input_edge_时和采集线程互斥
     int level_;
+    Executor* executor_;
+    duck::timer::TimerManager* timer_;
+    uint16_t node_id_;
+    uint16_t node_gen_;
+    NodeMetrics metrics_;
+
+    std::atomic<int> state_;
+    std::atomic<bool> quit_requested_;      //stop()请求，之后产生的数据都是退出帧
+    std::atomic<bool> abort_;               //排空超时，丢掉剩下的数据
+    std::atomic<Latch*> start_latch_;
+    std::atomic<Latch*> stop_latch_;
+    std::mutex exit_mutex_;
+    std::condition_variable exit_cond_;
+
+    std::mutex graph_mutex_;                //串行化append/detach/start/stop
+    std::atomic<NodeList*> children_;       //当前发布的子节点列表，只整体替换
+    std::atomic<int> epoch_;                //新读者登记的计数
+    std::atomic<int> readers_[2];
 };
 
 class RootNode : public PipeNode
 {
 public:
     RootNode(const std::string& node_name, int buff_num = 4) 
-        : PipeNode(node_name, buff_num), frame_count_(0), quit_(true) {}
+        : PipeNode(node_name, buff_num), frame_count_(0), stream_id_(0), pool_block_size_(0), pool_block_num_(0), budget_ns_(0) {}
+
+    virtual ~RootNode() {
+        //自己的输出缓冲里还持有缓冲池的块，要先于pool_释放；先退出登记，避免采集时访问已释放的缓冲
+        MetricsRegistry::instance().remove(this);
+        buff_.reset();
+    }
+
+    //配置本条流水线的缓冲池，start()时一次性分配。
+    //block_num要大于所有节点缓冲深度之和加上正在处理的帧数，否则alloc()会返回空句柄。
+    //停止后各节点的缓冲和边里还留着旧池的块，旧池先留着，块全部还回来后再释放
+    void set_pool(size_t block_size, size_t block_num) {
+        CHECK(!is_running()) << name() << " can't change buffer pool while running!";
+        pool_block_size_ = block_size;
+        pool_block_num_ = block_num;
+        if (pool_) {
+            retired_pools_.push_back(std::move(pool_));
+        }
+        release_retired_pools();
+    }
+
+    BufferPool* pool() {
+        return pool_.get();
+    }
+
+    //本节点产生的数据都带上这个stream_id，接到MuxNode上时由MuxNode分配
+    void set_stream_id(uint16_t stream_id) {
+        stream_id_ = stream_id;
+    }
+
+    uint16_t stream_id() {
+        return stream_id_;
+    }
+
+    //本条流水线的端到端延迟预算，本节点产生的每一帧都带上，下游的FilterNode据此丢掉来不及的帧。<= 0表示不限
+    void set_latency_budget_us(int64_t budget_us) {
+        budget_ns_.store((budget_us > 0) ? budget_us * 1000 : 0);
+    }
+
+    int64_t latency_budget_us() {
+        return budget_ns_.load() / 1000;
+    }
 
     virtual void process()
     {
+        ready();
         while(true)
         { 
-            PipeData pipe_data(frame_count_, quit_); 
-            PipeStamp pipe_stamp(name(), pipe_data.pipe_data_id());
-            pipe_stamp.record_now();
-
-            compute(pipe_data);
-
-            pipe_stamp.record_now();
-            pipe_data.push_stamp(pipe_stamp);
-
+            bool quit = quit_requested_.load();
+            PipeData pipe_data(frame_count_, quit); 
+            pipe_data.set_stream_id(stream_id_);
+
+            //排空阶段不再产生新数据，只发送退出帧
+            if (!quit) {
+                PipeStamp stamp(node_id(), node_gen());
+                stamp.record_dequeue();
+                stamp.record_start();
+
+                compute(pipe_data);
+
+                stamp.record_end();
+                stamp.record_enqueue();
+                if (pipe_data.capture_ns() == 0) {
+                    pipe_data.set_capture_ns(stamp.start_ns());
+                }
+                pipe_data.set_latency_budget_ns(budget_ns_.load(std::memory_order_relaxed));
+                metrics_.on_input();
+                metrics_.compute_ns().record(stamp.compute_ns());
+                metrics_.e2e_ns().record(stamp.end_ns() - pipe_data.capture_ns());
+                trace(pipe_data, stamp);
+                pipe_data.push_stamp(stamp);
+            }
             put_data(pipe_data);
             
-            if (pipe_data.quit()) {
-                if (is_child_quit()) {
+            if (quit) {
+                //等下游退出；写优先的缓冲里退出帧可能被覆盖，超时后再发一次
+                if (wait_child_quit(10)) {
                     break;
                 }
             }
@@ -255,119 +981,614 @@ public:
             frame_count_++;
         
         }
+        exited();
     }
 
-    virtual void compute(PipeData pipe_data) = 0;
+    virtual void compute(PipeData& pipe_data) = 0;
 
-    virtual void start() {
-        quit_ = false;
-        for (const auto node : next_node_list_) {
-            node->start();
+protected:
+    virtual void launch(Latch* latch) {
+        release_retired_pools();
+        if (!pool_ && (pool_block_num_ > 0)) {
+            pool_.reset(new BufferPool(pool_block_size_, pool_block_num_, name()));
+            pool_->bind_numa(sched_policy_.numa_node);
         }
-        Thread::start();
-        while(!is_running());
+        PipeNode::launch(latch);
     }
 
-    virtual void stop() {
-        quit_ = true;
-        PipeNode::stop();
+    //换下来的缓冲池等所有块都还回来才释放
+    void release_retired_pools() {
+        auto idle = [](const std::unique_ptr<BufferPool>& pool) { return pool->available() == pool->block_num(); };
+        retired_pools_.erase(std::remove_if(retired_pools_.begin(), retired_pools_.end(), idle), retired_pools_.end());
     }
 
-    
-
 protected:
     size_t frame_count_;
-    bool quit_;
+    uint16_t stream_id_;
+    size_t pool_block_size_;
+    size_t pool_block_num_;
+    std::unique_ptr<BufferPool> pool_;
+    std::vector<std::unique_ptr<BufferPool> > retired_pools_;
+    std::atomic<int64_t> budget_ns_;
 };
 
-class FilterNode : public PipeNode
+class FilterNode : public PipeNode, public Task
 {
 public:
-    FilterNode(const std::string& node_name, int buff_num = 4, long period_us = -1) : PipeNode(node_name, buff_num), period_us_(period_us), frame_count_(0) {
+    FilterNode(const std::string& node_name, int buff_num = 4, long period_us = -1) 
+        : PipeNode(node_name, buff_num), period_us_(period_us), frame_count_(0), signals_(0), spin_us_(0), tick_expire_us_(0),
+        pace_count_(0), missed_count_(0), jitter_sum_us_(0), max_jitter_us_(0), launch_seq_(0), decimation_(1), decimate_seq_(0),
+        decimated_(0), rate_changes_(0), deadline_policy_(DEADLINE_DROP), compute_avg_ns_(0), deadline_missed_(0), task_(false) {
+
+    }
 
+    virtual ~FilterNode() {
+        //先退出登记，采集线程不会再读到已经析构的replicas_和直方图
+        MetricsRegistry::instance().remove(this);
     }
 
     virtual void process() {
+        ready();
         if (period_us_ > 0) {
             pull_process();
         } else {
             push_process();
         }
+        exited();
     }
 
     void push_process() {
 
         while(true)
         {
-            PipeData pipe_data = pre_node()->get_data();
+            PipeData pipe_data;
+            if (input_edge_) {
+                input_edge_->pop(&pipe_data);
+            } else {
+                pipe_data = pre_node()->get_data(cursor_);
+            }
    
-            PipeStamp pipe_stamp(name(), pipe_data.pipe_data_id());
-            pipe_stamp.record_now();
+            if (handle(pipe_data)) {
+                break;
+            }
+        }
+    }
 
-            compute(pipe_data);
+    //拉模式按绝对截止时间定节拍：第n帧在start + n * period_us_处理，睡眠误差不会累积。
+    //处理超过一个周期时跳过错过的节拍并计数，保持原来的相位。
+    //输入是独立队列时每个节拍取队首的一帧，队列为空就跳过这个节拍，不会重复处理旧帧。
+    void pull_process() {
 
-            pipe_stamp.record_now();
-            pipe_data.push_stamp(pipe_stamp);
+        std::chrono::microseconds period(period_us_);
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+        while(true)
+        {
+            PipeData pipe_data;
+            bool ready = true;
+            if (input_edge_) {
+                ready = input_edge_->try_pop(&pipe_data);
+            } else {
+                pipe_data = pre_node()->get_data_async(cursor_);
+                ready = (cursor_.seq > launch_seq_);
+            }
 
-            put_data(pipe_data);
+            if ((ready || abort_.load(std::memory_order_relaxed)) && handle(pipe_data)) {
+                break;
+            }
 
-            if (pipe_data.quit()) {
-    
-                if (is_leaf()) {
-                    break;
-                } else {
-                    if (is_child_quit()) {
-                        break;
-                    }
-                }
+            deadline += period;
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (deadline <= now) {
+                int64_t missed = (now - deadline) / period + 1;
+                missed_count_.fetch_add(missed, std::memory_order_relaxed);
+                deadline += period * missed;
             }
+            pace_until(deadline);
+        }
+    }
 
+    //睡到deadline，最后spin_us_微秒忙等以减小唤醒抖动，记录实际唤醒的延迟
+    void pace_until(const std::chrono::steady_clock::time_point& deadline) {
+        std::chrono::steady_clock::time_point coarse = deadline - std::chrono::microseconds(spin_us_);
+        if (std::chrono::steady_clock::now() < coarse) {
+            std::this_thread::sleep_until(coarse);
         }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        while(now < deadline) {
+            std::this_thread::yield();
+            now = std::chrono::steady_clock::now();
+        }
+        record_pace(std::chrono::duration_cast<std::chrono::microseconds>(now - deadline).count());
     }
 
-    void pull_process() {
+    //拉模式的周期，<= 0表示推模式
+    long period_us() {
+        return period_us_;
+    }
 
-        while(true)
-        {
-            long t0 = now_us();
-            PipeData pipe_data = pre_node()->get_data_async();
+    //拉模式在截止时间之前最后忙等的时间，0表示纯睡眠
+    void set_spin_us(long spin_us) {
+        spin_us_ = (spin_us > 0) ? spin_us : 0;
+    }
 
-            PipeStamp pipe_stamp(name(), pipe_data.pipe_data_id());
-            pipe_stamp.record_now();
+    //拉模式错过的节拍数
+    int64_t missed_deadline_count() {
+        std::unique_lock<std::mutex> lock(tick_mutex_);
+        return missed_count_.load(std::memory_order_relaxed) + tick_timer_.overrun_count();
+    }
 
-            compute(pipe_data);
+    //拉模式平均唤醒延迟
+    int64_t jitter_us() {
+        int64_t count = pace_count_.load(std::memory_order_relaxed);
+        return (count > 0) ? (jitter_sum_us_.load(std::memory_order_relaxed) / count) : 0;
+    }
 
-            pipe_stamp.record_now();
-            pipe_data.push_stamp(pipe_stamp);
+    int64_t max_jitter_us() {
+        return max_jitter_us_.load(std::memory_order_relaxed);
+    }
 
-            put_data(pipe_data);
+    //处理一帧并交给下游，返回true表示本节点可以退出了。
+    //退出帧只向下游传递，不调用compute()；排空超时后剩下的数据直接丢掉，发一个退出帧就退出，
+    //下游也都被abort_drain()唤醒各自退出，不用再等
+    bool handle(PipeData& pipe_data) {
+        if (abort_.load(std::memory_order_relaxed)) {
+            if (replicas_) {
+                replicas_->drain(&abort_);
+            }
+            put_data(PipeData(pipe_data.pipe_data_id(), true));
+            return true;
+        }
 
-            if (pipe_data.quit()) {
-    
-                if (is_leaf()) {
-                    break;
-                } else {
-                    if (is_child_quit()) {
-                        break;
-                    }
+        //本节点是被stop()的子图的根，之后的数据都变成退出帧
+        if (quit_requested_.load(std::memory_order_relaxed)) {
+            pipe_data.set_quit(true);
+        }
+
+        if (!pipe_data.quit()) {
+            if (decimate()) {
+                return false;
+            }
+            if (replicas_) {
+                dispatch_replica(pipe_data);
+                return false;
+            }
+            if (doomed(pipe_data)) {
+                metrics_.set_input_seq(cursor_.seq);
+                if (deadline_policy_.load(std::memory_order_relaxed) == DEADLINE_PASS) {
+                    pass(pipe_data);
                 }
+                return false;
             }
 
-            long t1 = now_us();
-            long used_us = (t1 > t0) ? (t1 - t0) : (t0 - t1);
-            long diff_us = period_us_ - used_us;
-            if (diff_us > 0) {
-                std::chrono::microseconds us(diff_us);
-                std::this_thread::sleep_for(us);
+            PipeStamp stamp(node_id(), node_gen());
+            stamp.record_dequeue();
+            stamp.record_start();
+
+            compute(pipe_data);
+
+            stamp.record_end();
+            stamp.record_enqueue();
+            record_metrics(pipe_data, stamp);
+            trace(pipe_data, stamp);
+            pipe_data.push_stamp(stamp);
+        } else if (replicas_) {
+            //退出帧排在所有已分发的帧后面
+            replicas_->drain(&abort_);
+        }
+
+        put_data(pipe_data);
+
+        if (pipe_data.quit()) {
+            if (is_leaf() || is_child_quit()) {
+                return true;
             }
         }
+        return false;
     }
 
-    virtual void compute(PipeData pipe_data) = 0;
+    virtual void compute(PipeData& pipe_data) = 0;
+
+    //数据并行：num个副本线程同时执行compute()，按到达的顺序重新排好再交给下游，compute()必须可以并发调用。
+    //本节点的线程只负责取数据和分发。window限制已分发还没交给下游的帧数(0为2 * num)，
+    //最早的一帧超过timeout_us还没处理完就跳过它(<= 0时一直等)。num <= 1时关闭。必须在start()之前调用
+    void set_replicas(int num, int dispatch = REPLICA_ROUND_ROBIN, size_t window = 0, int64_t timeout_us = -1) {
+        CHECK(!is_running()) << name() << " can't change replicas while running!";
+        std::unique_ptr<ReplicaSet<ReplicaJob> > replicas;
+        if (num > 1) {
+            replicas.reset(new ReplicaSet<ReplicaJob>(name(), num, dispatch, window, timeout_us,
+                [this](ReplicaJob& job) { compute_replica(job); }, [this](ReplicaJob& job) { publish_replica(job); }));
+        }
+        std::unique_lock<std::mutex> lock(metrics_mutex_);
+        replicas_.swap(replicas);
+    }
+
+    int replica_num() {
+        return replicas_ ? replicas_->replica_num() : 1;
+    }
+
+    //副本模式下超时或者排空中止被跳过的帧数
+    uint64_t replica_skipped_count() {
+        return replicas_ ? replicas_->skipped_count() : 0;
+    }
+
+    //抽帧：每n帧只处理第1帧，其余的不调用compute()也不交给下游，整个子树的帧率随之降低。
+    //运行中可以随时修改，通常由RateController根据下游的负载调整
+    void set_decimation(int n) {
+        n = (n > 1) ? n : 1;
+        if (decimation_.exchange(n) != n) {
+            rate_changes_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    int decimation() {
+        return decimation_.load(std::memory_order_relaxed);
+    }
+
+    //因为抽帧没有处理的帧数
+    uint64_t decimated_count() {
+        return decimated_.load(std::memory_order_relaxed);
+    }
+
+    //帧带着截止时间时，剩下的时间不够本节点平均的compute()耗时就按policy处理，默认丢掉。
+    //录像这类不能丢帧的节点设成DEADLINE_IGNORE
+    void set_deadline_policy(int policy) {
+        deadline_policy_.store(policy);
+    }
+
+    int deadline_policy() {
+        return deadline_policy_.load();
+    }
+
+    //因为赶不上截止时间没有处理的帧数
+    uint64_t deadline_missed_count() {
+        return deadline_missed_.load(std::memory_order_relaxed);
+    }
+
+    virtual void collect_metrics(NodeMetricsSnapshot& snapshot) {
+        PipeNode::collect_metrics(snapshot);
+        {
+            std::unique_lock<std::mutex> lock(metrics_mutex_);
+            snapshot.replica_skipped = replica_skipped_count();
+        }
+        snapshot.deadline_missed = deadline_missed_count();
+        snapshot.decimation = decimation();
+        snapshot.decimated = decimated_count();
+        snapshot.rate_changes = rate_changes_.load(std::memory_order_relaxed);
+    }
+
+    virtual void on_input() {
+        if (executor_ && (period_us_ <= 0) && !replicas_) {
+            notify();
+        }
+    }
+
+    //请求调度一次。多次请求会合并，同一时刻只有一个worker在执行本节点。
+    //先登记再看是否在运行，和finish()先清运行标志、finish_stop()再等signals_归零配对，
+    //两边至少有一方看到对方，finish_stop()返回后不会再有新的调度
+    void notify() {
+        if (signals_.fetch_add(1) != 0) {
+            return;
+        }
+        if (is_running()) {
+            executor_->submit(this);
+        } else {
+            //没有投递，清掉这期间合并进来的请求
+            signals_.store(0);
+        }
+    }
+
+    //拉模式定时器的回调：记下这个节拍的到期时间，step()据此算唤醒延迟
+    void tick() {
+        tick_expire_us_.store(duck::timer::Timer::firing_expire_us(), std::memory_order_relaxed);
+        notify();
+    }
+
+    //Task接口，在executor的worker上执行。signals_减到0是最后一次访问本节点，之后finish_stop()才能返回
+    virtual void run() {
+        int pending = signals_.load();
+        while(true)
+        {
+            //拉模式合并进这一次调度的节拍没有单独处理，算作错过
+            if ((period_us_ > 0) && (pending > 1)) {
+                missed_count_.fetch_add(pending - 1, std::memory_order_relaxed);
+            }
+            step();
+            int left = signals_.fetch_sub(pending) - pending;
+            if (left == 0) {
+                break;
+            }
+            pending = left;
+        }
+    }
+
+    //输入边上被跳过(被上游覆盖或者被边的策略丢弃)的帧数
+    size_t dropped_count() {
+        return input_edge_ ? input_edge_->dropped_count() : metrics_.dropped();
+    }
+
+    virtual bool is_task() {
+        return task_.load();
+    }
 
 protected:
     long period_us_;
     size_t frame_count_;
+    ReadCursor cursor_;
+    std::atomic<int> signals_;
+    std::mutex tick_mutex_;                 //重启时替换tick_timer_，和统计线程互斥
+    duck::timer::TimerHandle tick_timer_;
+
+    long spin_us_;
+    std::atomic<int64_t> tick_expire_us_;   //executor模式最近一个节拍应该到期的时间
+    std::atomic<int64_t> pace_count_;
+    std::atomic<int64_t> missed_count_;
+    std::atomic<int64_t> jitter_sum_us_;
+    std::atomic<int64_t> max_jitter_us_;
+    size_t launch_seq_;         //启动时上游的写序号，不处理上一次运行留下的数据
+
+    struct ReplicaJob
+    {
+        ReplicaJob() : skipped(false) {}
+
+        PipeData pipe_data;
+        PipeStamp stamp;
+        bool skipped;       //赶不上截止时间，没有调用compute()
+    };
+    std::unique_ptr<ReplicaSet<ReplicaJob> > replicas_;
+
+    std::atomic<int> decimation_;
+    uint64_t decimate_seq_;                 //只在读输入的线程里访问
+    std::atomic<uint64_t> decimated_;
+    std::atomic<uint64_t> rate_changes_;
+
+    std::atomic<int> deadline_policy_;
+    std::atomic<int64_t> compute_avg_ns_;   //compute()耗时的滑动平均，估计处理一帧要多久
+    std::atomic<uint64_t> deadline_missed_;
+
+    std::atomic<bool> task_;                //最近一次启动是否作为executor任务
+
+    virtual void release_input() {
+        if (pre_node()) {
+            pre_node()->release_cursor(cursor_);
+        }
+    }
+
+    //从上游当前的位置开始读，上一次运行留下的数据(包括退出帧)不再处理
+    virtual void launch(Latch* latch) {
+        release_input();
+        cursor_.abort = &abort_;
+        cursor_.seq = pre_node()->output_seq();
+        launch_seq_ = cursor_.seq;
+
+        //副本模式的分发要阻塞等待；下游有无损的边时put_data()会被背压阻塞，占住worker可能让下游的任务
+        //一直拿不到worker而死锁。这两种情况都用自己的线程
+        task_.store(executor_ && !replicas_ && !has_lossless_child());
+        if (!task_.load()) {
+            if (replicas_) {
+                replicas_->start();
+            }
+            PipeNode::launch(latch);
+            return;
+        }
+
+        launch_children(latch);
+        reset_state();
+        set_running(true);
+        if (period_us_ > 0) {
+            CHECK(timer_) << name() << " pull mode on executor need a timer manager!";
+            tick_expire_us_.store(0);
+            std::unique_lock<std::mutex> lock(tick_mutex_);
+            tick_timer_ = timer_->submit_us(period_us_, -1, 0, &FilterNode::tick, this);
+        }
+        LOG(INFO) << name() << " task is running!";
+        latch->count_down();
+    }
+
+    virtual void finish_stop() {
+        {
+            //错过的节拍累计到missed_count_里，重启后不清零
+            std::unique_lock<std::mutex> lock(tick_mutex_);
+            tick_timer_.cancel();
+            missed_count_.fetch_add(tick_timer_.overrun_count(), std::memory_order_relaxed);
+            tick_timer_.reset();
+        }
+        PipeNode::finish_stop();
+        //executor模式没有线程可以join：exited()在step()里倒数之后run()还会访问本节点，
+        //等已经投递的任务执行完，stop()/detach()返回后节点才可以析构
+        while(signals_.load() != 0) {
+            std::this_thread::yield();
+        }
+        if (replicas_) {
+            replicas_->stop();
+        }
+    }
+
+    bool has_lossless_child() {
+        for (const auto node : ChildrenRef(this)) {
+            if (node->input_edge() && (node->input_edge()->policy() == EDGE_LOSSLESS)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //在stamp压入pipe_data之前调用，此时最后一个stamp是上游节点的
+    void record_metrics(PipeData& pipe_data, PipeStamp& stamp) {
+        record_input();
+        record_timing(pipe_data, stamp);
+    }
+
+    //取到一帧时的计数，只在读输入的线程里调用
+    void record_input() {
+        metrics_.on_input();
+        metrics_.set_dropped(input_edge_ ? input_edge_->dropped_count() : cursor_.dropped);
+        metrics_.set_input_seq(cursor_.seq);
+    }
+
+    void record_timing(PipeData& pipe_data, PipeStamp& stamp) {
+        metrics_.compute_ns().record(stamp.compute_ns());
+        int64_t avg = compute_avg_ns_.load(std::memory_order_relaxed);
+        compute_avg_ns_.store(avg + (stamp.compute_ns() - avg) / 8, std::memory_order_relaxed);
+        PipeStamp* prev = pipe_data.back_stamp();
+        if (prev) {
+            metrics_.queue_ns().record(stamp.queue_ns(*prev));
+            metrics_.e2e_ns().record(stamp.end_ns() - pipe_data.origin_ns());
+        }
+    }
+
+    //剩下的时间不够处理这一帧了
+    bool doomed(PipeData& pipe_data) {
+        int64_t deadline = pipe_data.deadline_ns();
+        if ((deadline == 0) || (deadline_policy_.load(std::memory_order_relaxed) == DEADLINE_IGNORE)) {
+            return false;
+        }
+        int64_t avg = compute_avg_ns_.load(std::memory_order_relaxed);
+        if (PipeStamp::now_ns() + avg <= deadline) {
+            return false;
+        }
+        //丢掉的帧不会更新估计，每丢一帧衰减一点：一次偶然的慢帧之后迟早会放一帧过去重新测量，
+        //compute()确实慢时也只是隔几帧试一次
+        compute_avg_ns_.store(avg - avg / 8, std::memory_order_relaxed);
+        deadline_missed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //不处理，原样交给下游，时间线上是一个空的stamp
+    void pass(PipeData& pipe_data) {
+        PipeStamp stamp(node_id(), node_gen());
+        stamp.record_dequeue();
+        stamp.record_start();
+        stamp.record_end();
+        stamp.record_enqueue();
+        trace(pipe_data, stamp);
+        pipe_data.push_stamp(stamp);
+        put_data(pipe_data);
+    }
+
+    //这一帧是否被抽掉，在读输入的线程里调用
+    bool decimate() {
+        int n = decimation_.load(std::memory_order_relaxed);
+        if (n <= 1) {
+            return false;
+        }
+        if ((decimate_seq_++ % n) == 0) {
+            return false;
+        }
+        decimated_.fetch_add(1, std::memory_order_relaxed);
+        metrics_.set_input_seq(cursor_.seq);
+        return true;
+    }
+
+    void dispatch_replica(PipeData& pipe_data) {
+        ReplicaJob job;
+        job.pipe_data = pipe_data;
+        job.stamp = PipeStamp(node_id(), node_gen());
+        job.stamp.record_dequeue();
+        record_input();
+        replicas_->dispatch(job);
+    }
+
+    //在副本线程上执行，排队之后再检查截止时间
+    void compute_replica(ReplicaJob& job) {
+        if (abort_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (doomed(job.pipe_data)) {
+            job.skipped = true;
+            return;
+        }
+        job.stamp.record_start();
+        compute(job.pipe_data);
+        job.stamp.record_end();
+    }
+
+    //按分发的顺序调用，同一时刻只有一个线程在发布
+    void publish_replica(ReplicaJob& job) {
+        if (abort_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (job.skipped) {
+            if (deadline_policy_.load(std::memory_order_relaxed) == DEADLINE_PASS) {
+                pass(job.pipe_data);
+            }
+            return;
+        }
+        job.stamp.record_enqueue();
+        record_timing(job.pipe_data, job.stamp);
+        trace(job.pipe_data, job.stamp);
+        job.pipe_data.push_stamp(job.stamp);
+        put_data(job.pipe_data);
+    }
+
+    void record_pace(int64_t late_us) {
+        pace_count_.fetch_add(1, std::memory_order_relaxed);
+        jitter_sum_us_.fetch_add(late_us, std::memory_order_relaxed);
+        if (late_us > max_jitter_us_.load(std::memory_order_relaxed)) {
+            max_jitter_us_.store(late_us, std::memory_order_relaxed);
+        }
+    }
+
+protected:
+    //非阻塞地处理输入上的数据，拉模式取最新一帧，推模式只取比上次新的一帧
+    void step() {
+        if (!is_running()) {
+            return;
+        }
+
+        if (period_us_ > 0) {
+            //相对这个节拍应该到期的时间算，晚了超过一个周期也如实记录
+            int64_t expire = tick_expire_us_.load(std::memory_order_relaxed);
+            if (expire > 0) {
+                record_pace(std::max<int64_t>(now_us() - expire, 0));
+            }
+        }
+
+        PipeData pipe_data;
+        //排空中止后上游可能不会再来数据，不等输入直接退出
+        if (abort_.load(std::memory_order_relaxed)) {
+            if (handle(pipe_data)) {
+                finish();
+            }
+            return;
+        }
+
+        if (input_edge_) {
+            //多个通知可能合并成一次调度，推模式把队列里的帧都处理完，拉模式每个节拍只取一帧
+            while(input_edge_->try_pop(&pipe_data))
+            {
+                if (handle(pipe_data)) {
+                    finish();
+                    return;
+                }
+                if (period_us_ > 0) {
+                    return;
+                }
+            }
+            return;
+        }
+
+        if (period_us_ > 0) {
+            if (pre_node()->try_get_data_async(cursor_, &pipe_data) && (cursor_.seq > launch_seq_) && handle(pipe_data)) {
+                finish();
+            }
+            return;
+        }
+
+        //共享缓冲按序号依次读，合并的通知只调度一次，要读到追上上游为止，否则会一直落后，最后的退出帧也读不到
+        while(pre_node()->try_get_data(cursor_, &pipe_data))
+        {
+            if ((cursor_.seq > launch_seq_) && handle(pipe_data)) {
+                finish();
+                return;
+            }
+        }
+    }
+
+    void finish() {
+        set_running(false);
+        exited();
+        LOG(INFO) << name() << " task is quit!";
+    }
 };
 
 
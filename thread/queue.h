@@ -2,10 +2,12 @@
 
 
 #include <iostream>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
-#include <list>
-#include <vector>
+#include <chrono>
+#include <thread>
+#include <string>
 #include <memory>
 #include <glog/logging.h>
 
@@ -13,61 +15,176 @@ namespace duck {
 namespace thread {
 
 
+#ifndef DUCK_CACHE_LINE_SIZE
+#define DUCK_CACHE_LINE_SIZE 64
+#endif
+
+//有界的多生产者多消费者队列(Vyukov)，单元格在构造时一次性分配，push/pop不再分配内存。
+//每个单元格带一个序号，生产者和消费者各用一个原子位置CAS抢占单元格；
+//阻塞版本先尝试无锁操作，只有确实要挂起时才使用mutex/condvar，而且对端只在有人挂起时才去通知。
+//队列总是有界的，deep必须由调用者给出，满了之后push()会阻塞；序号区分空和满至少需要2个单元格，deep为1时按2处理。
 template<typename T>
 class SafeQueue
 {
 public:
-    SafeQueue(int deep = -1, const std::string& queue_name = std::string()) : deep_(deep), queue_name_(queue_name) {
+    explicit SafeQueue(int deep, const std::string& queue_name = std::string())
+        : deep_((deep > 1) ? (size_t)deep : (size_t)2), queue_name_(queue_name), cells_(new Cell[deep_]) {
+
+        CHECK(deep > 0) << queue_name << " SafeQueue deep must be positive, it's not an unbounded queue any more!";
 
+        for (size_t i = 0; i < deep_; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        enqueue_pos_.store(0);
+        dequeue_pos_.store(0);
+        full_waiters_.store(0);
+        empty_waiters_.store(0);
     }
- 
 
-    void push(T data) {
+    SafeQueue(const SafeQueue&) = delete;
+    SafeQueue& operator=(const SafeQueue&) = delete;
 
-        std::unique_lock<std::mutex> lock(mutex_);
 
-        while(((deep_ > 0) && (list_.size() >= deep_))) {
-            LOG(INFO) << name() << " queue is full, wait an available position...";
-            full_cond_.wait(lock);
+    void push(const T& data) {
+        while(!try_push(data)) {
+            wait_writable(nullptr);
         }
-        list_.push_back(data);
-        empty_cond_.notify_one(); 
-
     }
 
     T pop() {
+        T data;
+        while(!try_pop(&data)) {
+            wait_readable(nullptr);
+        }
+        return data;
+    }
 
-        std::unique_lock<std::mutex> lock(mutex_);
+    bool try_push(const T& data) {
+        size_t pos = 0;
+        if (claim(&enqueue_pos_, 0, 1, &pos) == 0) {
+            return false;
+        }
+        Cell& cell = cells_[pos % deep_];
+        cell.data = data;
+        cell.seq.store(pos + 1, std::memory_order_release);
+        notify_readable();
+        return true;
+    }
 
-        while(list_.empty()) {
-            LOG(INFO) << name() << " queue is empty, wait an available data...";
-            empty_cond_.wait(lock);
+    bool try_pop(T* data) {
+        size_t pos = 0;
+        if (claim(&dequeue_pos_, 1, 1, &pos) == 0) {
+            return false;
         }
-        T data = list_.front();
-        list_.pop_front();
-        full_cond_.notify_one(); 
+        Cell& cell = cells_[pos % deep_];
+        *data = std::move(cell.data);
+        cell.seq.store(pos + deep_, std::memory_order_release);
+        notify_writable();
+        return true;
+    }
 
-        return data;
+    //超时返回false，timeout_us < 0表示一直等待
+    bool push_for(const T& data, int64_t timeout_us) {
+        if (timeout_us < 0) {
+            push(data);
+            return true;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+        while(!try_push(data)) {
+            if (!wait_writable(&deadline)) {
+                return try_push(data);
+            }
+        }
+        return true;
+    }
+
+    bool pop_for(T* data, int64_t timeout_us) {
+        if (timeout_us < 0) {
+            *data = pop();
+            return true;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+        while(!try_pop(data)) {
+            if (!wait_readable(&deadline)) {
+                return try_pop(data);
+            }
+        }
+        return true;
+    }
+
+    //一次CAS尽量多地放入数据，返回实际放入的个数
+    size_t try_push_bulk(const T* data, size_t num) {
+        size_t pos = 0;
+        size_t count = claim(&enqueue_pos_, 0, num, &pos);
+        for (size_t i = 0; i < count; i++) {
+            Cell& cell = cells_[(pos + i) % deep_];
+            cell.data = data[i];
+            cell.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        if (count > 0) {
+            notify_readable();
+        }
+        return count;
+    }
+
+    //阻塞直到num个数据全部放入
+    void push_bulk(const T* data, size_t num) {
+        size_t done = 0;
+        while(done < num)
+        {
+            size_t count = try_push_bulk(data + done, num - done);
+            if (count == 0) {
+                wait_writable(nullptr);
+            }
+            done += count;
+        }
+    }
+
+    //一次CAS尽量多地取出数据，最多max_num个，返回实际取出的个数
+    size_t try_pop_bulk(T* data, size_t max_num) {
+        size_t pos = 0;
+        size_t count = claim(&dequeue_pos_, 1, max_num, &pos);
+        for (size_t i = 0; i < count; i++) {
+            Cell& cell = cells_[(pos + i) % deep_];
+            data[i] = std::move(cell.data);
+            cell.seq.store(pos + i + deep_, std::memory_order_release);
+        }
+        if (count > 0) {
+            notify_writable();
+        }
+        return count;
+    }
+
+    //阻塞直到至少取出一个数据，timeout_us < 0表示一直等待，超时返回0
+    size_t pop_bulk(T* data, size_t max_num, int64_t timeout_us = -1) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((timeout_us > 0) ? timeout_us : 0);
+        while(true)
+        {
+            size_t count = try_pop_bulk(data, max_num);
+            if (count > 0) {
+                return count;
+            }
+            if (!wait_readable((timeout_us < 0) ? nullptr : &deadline)) {
+                return try_pop_bulk(data, max_num);
+            }
+        }
     }
 
     bool empty() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        return list_.empty();
+        return (count() == 0);
     }
 
     bool full() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        bool is_full = ((deep_ > 0) && (list_.size() >= deep_)) ? true : false;
-        return is_full;
+        return (count() >= deep_);
     }
 
     size_t count() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        return list_.size();
+        size_t enqueue = enqueue_pos_.load(std::memory_order_acquire);
+        size_t dequeue = dequeue_pos_.load(std::memory_order_acquire);
+        return (enqueue > dequeue) ? (enqueue - dequeue) : 0;
     }
 
     int deep() {
-        std::unique_lock<std::mutex> lock(mutex_);
         return deep_;
     }
 
@@ -77,23 +194,131 @@ public:
 
 
 protected:
-    int deep_;
-    std::string queue_name_;
-    std::list<T > list_;
-    std::mutex mutex_;
-    std::condition_variable full_cond_;
-    std::condition_variable empty_cond_;
-};
-
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+        char pad_[DUCK_CACHE_LINE_SIZE];
+    };
+
+    //从pos_处抢占最多max_num个连续的就绪单元格，offset为0表示抢空位(生产者)，为1表示抢数据(消费者)
+    size_t claim(std::atomic<size_t>* pos_, size_t offset, size_t max_num, size_t* first) {
+        if (max_num == 0) {
+            return 0;
+        }
 
-}//namespace thread
-}//namespace duck
+        size_t pos = pos_->load(std::memory_order_relaxed);
+        while(true)
+        {
+            size_t count = 0;
+            while(count < max_num) {
+                size_t seq = cells_[(pos + count) % deep_].seq.load(std::memory_order_acquire);
+                if (seq != pos + count + offset) {
+                    break;
+                }
+                count++;
+            }
+
+            if (count == 0) {
+                size_t seq = cells_[pos % deep_].seq.load(std::memory_order_acquire);
+                if ((intptr_t)(seq - (pos + offset)) < 0) {
+                    //队列满(生产者)或者空(消费者)
+                    return 0;
+                }
+                pos = pos_->load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (pos_->compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                *first = pos;
+                return count;
+            }
+        }
+    }
 
+    bool writable() {
+        size_t pos = enqueue_pos_.load();
+        size_t seq = cells_[pos % deep_].seq.load();
+        return ((intptr_t)(seq - pos) >= 0);
+    }
 
+    bool readable() {
+        size_t pos = dequeue_pos_.load();
+        size_t seq = cells_[pos % deep_].seq.load();
+        return ((intptr_t)(seq - (pos + 1)) >= 0);
+    }
 
+    //等待队列有空位，超时返回false
+    bool wait_writable(const std::chrono::steady_clock::time_point* deadline) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        full_waiters_.fetch_add(1);
+        //和notify_writable()里的fence配对：要么这里看到新的seq，要么对方看到等待者
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ok = true;
+        while(!writable()) {
+            if (!deadline) {
+                full_cond_.wait(lock);
+            } else if (full_cond_.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                ok = writable();
+                break;
+            }
+        }
+        full_waiters_.fetch_sub(1);
+        return ok;
+    }
 
+    //等待队列有数据，超时返回false
+    bool wait_readable(const std::chrono::steady_clock::time_point* deadline) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        empty_waiters_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ok = true;
+        while(!readable()) {
+            if (!deadline) {
+                empty_cond_.wait(lock);
+            } else if (empty_cond_.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                ok = readable();
+                break;
+            }
+        }
+        empty_waiters_.fetch_sub(1);
+        return ok;
+    }
 
+    //seq是release写，后面读等待者计数可能被重排到写之前(StoreLoad)，中间要一个完整的fence，否则会丢失唤醒
+    void notify_writable() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (full_waiters_.load() > 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            full_cond_.notify_all();
+        }
+    }
 
+    void notify_readable() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (empty_waiters_.load() > 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            empty_cond_.notify_all();
+        }
+    }
 
+protected:
+    size_t deep_;
+    std::string queue_name_;
+    std::unique_ptr<Cell[]> cells_;
+
+    char pad0_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<size_t> enqueue_pos_;
+    char pad1_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<size_t> dequeue_pos_;
+    char pad2_[DUCK_CACHE_LINE_SIZE];
+    std::atomic<int> full_waiters_;
+    std::atomic<int> empty_waiters_;
+    std::mutex mutex_;
+    std::condition_variable full_cond_;
+    std::condition_variable empty_cond_;
+};
 
 
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iterator>
+#include <mutex>
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "thread/pipe_thread.h"
+
+
+namespace duck {
+namespace thread {
+
+
+struct RateControlPolicy
+{
+    RateControlPolicy() : max_decimation(4), high_watermark(0.75), low_watermark(0.25), headroom(0.9), hold_ticks(3), settle_ticks(2) {}
+
+    int max_decimation;         //最多每几帧留一帧
+    double high_watermark;      //队列占用超过这个比例算过载
+    double low_watermark;       //队列占用都低于这个比例才考虑恢复帧率
+    double headroom;            //compute() p99最多占用帧间隔的比例
+    int hold_ticks;             //连续空闲这么多次才降低一档抽帧，避免来回抖动
+    int settle_ticks;           //调整之后这么多次不做判断，等已有的积压消化掉
+};
+
+//一个分支的帧率控制器：周期调用update()(例如用TimerManager每500ms一次)，根据分支里各节点在这个窗口内的
+//队列占用、被覆盖的帧和compute()的p99调整分支根节点的抽帧倍数。过载时立即加一档，空闲持续hold_ticks次才减一档。
+//过载的判断：
+//  1. 输入边的占用或者推模式节点在共享缓冲上的积压超过high_watermark
+//  2. 推模式节点有帧被上游覆盖或者被输入边丢弃(拉模式按节拍取最新帧，跳帧是正常的，不算)
+//  3. 推模式节点compute()的p99(按副本数折算)超过headroom * 帧间隔 * 抽帧倍数
+//每次调整打印一条日志，并体现在根节点的duck_pipe_decimation和duck_pipe_rate_changes指标上
+class RateController
+{
+public:
+    RateController(FilterNode* branch, const RateControlPolicy& policy = RateControlPolicy())
+        : branch_(branch), policy_(policy), idle_ticks_(0), settle_ticks_(0), last_offered_(0), last_ns_(0) {}
+
+    FilterNode* branch() {
+        return branch_;
+    }
+
+    int decimation() {
+        return branch_->decimation();
+    }
+
+    void update() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (branch_->state() != NODE_RUNNING) {
+            //重启后重新开始计窗口
+            last_ns_ = 0;
+            return;
+        }
+
+        std::vector<PipeNode*> nodes;
+        branch_->collect_subtree(nodes);
+        std::map<PipeNode*, NodeMetricsSnapshot> snapshots;
+        for (const auto node : nodes) {
+            node->collect_metrics(snapshots[node]);
+        }
+        //已经摘下的分支不再跟踪
+        for (auto it = windows_.begin(); it != windows_.end(); ) {
+            it = snapshots.count(it->first) ? std::next(it) : windows_.erase(it);
+        }
+
+        //分支根节点在这个窗口内收到的帧(包括抽掉的)，第一次只记录起点
+        const NodeMetricsSnapshot& root = snapshots[branch_];
+        int64_t now = PipeStamp::now_ns();
+        uint64_t offered = root.frames_in + root.decimated;
+        bool first = (last_ns_ == 0);
+        uint64_t window_frames = offered - last_offered_;
+        int64_t window_ns = now - last_ns_;
+        last_offered_ = offered;
+        last_ns_ = now;
+
+        std::string reason;
+        bool idle = true;
+        int decimation = branch_->decimation();
+        double interval_ns = (window_frames > 0) ? ((double)window_ns / window_frames) : 0;
+        for (const auto node : nodes) {
+            const NodeMetricsSnapshot& snapshot = snapshots[node];
+            Window& window = windows_[node];
+            HistogramSnapshot compute = snapshot.compute_ns.since(window.compute_ns);
+            uint64_t dropped = snapshot.dropped - std::min(snapshot.dropped, window.dropped);
+            window.compute_ns = snapshot.compute_ns;
+            window.dropped = snapshot.dropped;
+            if (first) {
+                continue;
+            }
+
+            FilterNode* filter = dynamic_cast<FilterNode*>(node);
+            bool push = filter && (filter->period_us() <= 0);
+
+            //有输入边时看边的占用；读共享缓冲的推模式节点看落后上游多少帧
+            double occupancy = 0;
+            PipeEdge<PipeData>* edge = node->input_edge();
+            PipeNode* pre_node = node->pre_node();
+            if (edge) {
+                occupancy = (double)snapshot.edge_occupancy / std::max(edge->deep(), 1);
+            } else if (push && pre_node) {
+                uint64_t published = pre_node->metrics().frames_out();
+                uint64_t seq = node->metrics().input_seq();
+                occupancy = (published > seq) ? ((double)(published - seq) / std::max(pre_node->buff_num(), 1)) : 0;
+            }
+            double compute_p99 = push ? (double)compute.percentile(0.99) / filter->replica_num() : 0;
+            double budget = policy_.headroom * interval_ns * decimation;
+
+            if (reason.empty()) {
+                if (occupancy >= policy_.high_watermark) {
+                    reason = node->name() + " queue " + std::to_string((int)(occupancy * 100)) + "%";
+                } else if (push && (dropped > 0)) {
+                    reason = node->name() + " dropped " + std::to_string(dropped);
+                } else if (push && (compute.count > 0) && (interval_ns > 0) && (compute_p99 > budget)) {
+                    reason = node->name() + " compute p99 " + std::to_string((int64_t)(compute_p99 / 1000)) + "us";
+                }
+            }
+
+            //少抽一档之后也要放得下
+            double relaxed_budget = policy_.headroom * interval_ns * (decimation - 1);
+            if ((occupancy > policy_.low_watermark) || (push && (dropped > 0)) || (compute_p99 > relaxed_budget)) {
+                idle = false;
+            }
+        }
+        if (first) {
+            return;
+        }
+        if (settle_ticks_ > 0) {
+            settle_ticks_--;
+            return;
+        }
+
+        if (!reason.empty()) {
+            idle_ticks_ = 0;
+            if (decimation < policy_.max_decimation) {
+                change(decimation + 1, reason);
+            }
+        } else if (idle && (decimation > 1)) {
+            if (++idle_ticks_ >= policy_.hold_ticks) {
+                idle_ticks_ = 0;
+                change(decimation - 1, "idle");
+            }
+        } else {
+            idle_ticks_ = 0;
+        }
+    }
+
+protected:
+    struct Window
+    {
+        Window() : dropped(0) {}
+
+        HistogramSnapshot compute_ns;
+        uint64_t dropped;
+    };
+
+    void change(int decimation, const std::string& reason) {
+        LOG(WARNING) << branch_->name() << " decimation " << branch_->decimation() << " -> " << decimation << " (" << reason << ")";
+        branch_->set_decimation(decimation);
+        settle_ticks_ = policy_.settle_ticks;
+    }
+
+protected:
+    FilterNode* branch_;
+    RateControlPolicy policy_;
+    std::mutex mutex_;
+    std::map<PipeNode*, Window> windows_;
+    int idle_ticks_;
+    int settle_ticks_;
+    uint64_t last_offered_;
+    int64_t last_ns_;
+};
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <glog/logging.h>
+
+#include "thread/thread.h"
+
+
+namespace duck {
+namespace thread {
+
+
+//副本的分发方式
+enum ReplicaDispatch
+{
+    REPLICA_ROUND_ROBIN = 0,    //依次分给每个副本
+    REPLICA_LEAST_LOADED,       //分给排队加处理中最少的副本
+};
+
+//同一个compute()在num个副本线程上并行执行，结果按dispatch()的顺序交给publish。
+//window限制已分发但还没有发布的数量，满了dispatch()阻塞；队首超过timeout_us还没处理完就跳过它，
+//后面处理完的可以先发布，被跳过的之后处理完直接丢掉(还没开始处理的不再处理)。timeout_us <= 0时一直等。
+//publish在单独的发布线程里按顺序调用，不持锁，可以阻塞：下游慢时窗口填满，dispatch()随之阻塞，副本线程不受影响。
+template<typename T>
+class ReplicaSet
+{
+public:
+    typedef std::function<void(T&)> Compute;
+    typedef std::function<void(T&)> Publish;
+
+    ReplicaSet(const std::string& set_name, int num, int dispatch, size_t window, int64_t timeout_us, Compute compute, Publish publish)
+        : name_(set_name), dispatch_(dispatch), window_((window > 0) ? window : 2 * num), timeout_ns_(timeout_us * 1000),
+        compute_(compute), publish_(publish), publisher_(name_ + "_out", this), quit_(false), publishing_(false), head_seq_(0), next_seq_(0),
+        next_replica_(0), skipped_(0) {
+        CHECK(num > 0) << name_ << " needs at least one replica!";
+        for (int i = 0; i < num; i++) {
+            replicas_.emplace_back(new Replica(name_ + "_r" + std::to_string(i), this));
+        }
+    }
+
+    ~ReplicaSet() {
+        stop();
+    }
+
+    ReplicaSet(const ReplicaSet&) = delete;
+    ReplicaSet& operator=(const ReplicaSet&) = delete;
+
+    //启动副本线程和发布线程，序号从0开始
+    void start() {
+        stop();
+        std::unique_lock<std::mutex> lock(mutex_);
+        quit_ = false;
+        slots_.clear();
+        head_seq_ = 0;
+        next_seq_ = 0;
+        next_replica_ = 0;
+        for (auto& replica : replicas_) {
+            replica->jobs.clear();
+            replica->load = 0;
+        }
+        lock.unlock();
+        for (auto& replica : replicas_) {
+            replica->start();
+        }
+        publisher_.start();
+    }
+
+    //副本线程处理完手上的任务后退出，还在排队和没发布的任务丢掉
+    void stop() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        cond_.notify_all();
+        for (auto& replica : replicas_) {
+            replica->join();
+        }
+        publisher_.join();
+    }
+
+    //分发一个任务，窗口满了等到有空位(或者队首超时被跳过)
+    void dispatch(const T& value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(next_seq_ - head_seq_ >= window_)
+        {
+            if (!expire_head()) {
+                cond_.wait_for(lock, wait_step());
+            }
+        }
+
+        Replica* replica = pick();
+        Slot slot;
+        slot.value = value;
+        slot.done = false;
+        slot.dispatch_ns = now_ns();
+        slots_.push_back(slot);
+        replica->jobs.push_back(next_seq_++);
+        replica->load++;
+        cond_.notify_all();
+    }
+
+    //等所有已分发的任务发布或者被跳过；abort变成true时丢掉剩下的任务
+    void drain(const std::atomic<bool>* abort = nullptr) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(!slots_.empty() || publishing_)
+        {
+            if (abort && abort->load()) {
+                skipped_.fetch_add(slots_.size(), std::memory_order_relaxed);
+                head_seq_ += slots_.size();
+                slots_.clear();
+                cond_.notify_all();
+                continue;
+            }
+            cond_.wait_for(lock, wait_step());
+        }
+    }
+
+    int replica_num() {
+        return replicas_.size();
+    }
+
+    //因为超时或者排空中止被跳过的任务数
+    uint64_t skipped_count() {
+        return skipped_.load(std::memory_order_relaxed);
+    }
+
+    //已分发还没有发布的任务数
+    size_t in_flight() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return slots_.size();
+    }
+
+protected:
+    struct Slot
+    {
+        T value;
+        bool done;
+        int64_t dispatch_ns;
+    };
+
+    class Replica : public Thread
+    {
+    public:
+        Replica(const std::string& replica_name, ReplicaSet* owner) : Thread(replica_name), set(owner), load(0) {}
+
+        virtual void process() {
+            set->work(this);
+        }
+
+        ReplicaSet* set;
+        std::deque<uint64_t> jobs;      //分给本副本的序号
+        int load;                       //排队加处理中的任务数
+    };
+
+    class Publisher : public Thread
+    {
+    public:
+        Publisher(const std::string& publisher_name, ReplicaSet* owner) : Thread(publisher_name), set(owner) {}
+
+        virtual void process() {
+            set->publish_loop();
+        }
+
+        ReplicaSet* set;
+    };
+
+    static int64_t now_ns() {
+        auto now = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    }
+
+    //等待时的检查间隔，不超过超时时间
+    std::chrono::nanoseconds wait_step() {
+        int64_t step_ns = 10000000;
+        if ((timeout_ns_ > 0) && (timeout_ns_ < step_ns)) {
+            step_ns = timeout_ns_;
+        }
+        return std::chrono::nanoseconds(step_ns);
+    }
+
+    Replica* pick() {
+        size_t num = replicas_.size();
+        size_t index = next_replica_;
+        next_replica_ = (next_replica_ + 1) % num;
+        if (dispatch_ == REPLICA_LEAST_LOADED) {
+            //从轮询的位置开始找，负载相同时依次分开
+            for (size_t i = 1; i < num; i++) {
+                size_t other = (next_replica_ + num - 1 + i) % num;
+                if (replicas_[other]->load < replicas_[index]->load) {
+                    index = other;
+                }
+            }
+        }
+        return replicas_[index].get();
+    }
+
+    //队首超时没有处理完就跳过，调用者持有mutex_
+    bool expire_head() {
+        if ((timeout_ns_ <= 0) || slots_.empty() || slots_.front().done) {
+            return false;
+        }
+        if (now_ns() - slots_.front().dispatch_ns < timeout_ns_) {
+            return false;
+        }
+        slots_.pop_front();
+        head_seq_++;
+        skipped_.fetch_add(1, std::memory_order_relaxed);
+        cond_.notify_all();
+        return true;
+    }
+
+    //按顺序发布处理完的任务，队首没处理完时等它完成或者超时
+    void publish_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(true)
+        {
+            if (quit_) {
+                break;
+            }
+            if (expire_head()) {
+                continue;
+            }
+            if (slots_.empty() || !slots_.front().done) {
+                cond_.wait_for(lock, wait_step());
+                continue;
+            }
+
+            T value = slots_.front().value;
+            slots_.pop_front();
+            head_seq_++;
+            publishing_ = true;
+            lock.unlock();
+            publish_(value);
+            lock.lock();
+            publishing_ = false;
+            cond_.notify_all();
+        }
+    }
+
+    void work(Replica* replica) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(true)
+        {
+            cond_.wait(lock, [this, replica] { return quit_ || !replica->jobs.empty(); });
+            if (quit_) {
+                break;
+            }
+
+            uint64_t seq = replica->jobs.front();
+            replica->jobs.pop_front();
+            //已经被跳过的不再处理
+            if (seq < head_seq_) {
+                replica->load--;
+                continue;
+            }
+
+            T value = slots_[seq - head_seq_].value;
+            lock.unlock();
+            compute_(value);
+            lock.lock();
+            replica->load--;
+
+            //处理期间可能超时被跳过了
+            if (seq >= head_seq_) {
+                Slot& slot = slots_[seq - head_seq_];
+                slot.value = value;
+                slot.done = true;
+                cond_.notify_all();
+            }
+        }
+    }
+
+protected:
+    std::string name_;
+    int dispatch_;
+    size_t window_;
+    int64_t timeout_ns_;
+    Compute compute_;
+    Publish publish_;
+    std::vector<std::unique_ptr<Replica> > replicas_;
+    Publisher publisher_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool quit_;
+    bool publishing_;
+    std::deque<Slot> slots_;            //slots_[i]的序号是head_seq_ + i
+    uint64_t head_seq_;                 //下一个要发布的序号
+    uint64_t next_seq_;                 //下一个分发的序号
+    size_t next_replica_;
+    std::atomic<uint64_t> skipped_;
+};
+
+
+}//namespace thread
+}//namespace duck
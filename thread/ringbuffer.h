@@ -6,6 +6,7 @@
 #include <list>
 #include <vector>
 #include <memory>
+#include <atomic>
 #include <glog/logging.h>
 
 
@@ -13,19 +14,52 @@ namespace duck {
 namespace thread {
 
 
+//读者游标：每个消费者记住上次读到的写序号，阻塞读只等比它更新的数据。
+//序号从1开始，0表示还没有读过。
+struct ReadCursor
+{
+    ReadCursor() : seq(0), skipped(0), dropped(0), consumer(-1), owner(nullptr), abort(nullptr) {}
+
+    //读到序号为seq的数据后更新游标，返回这次跳过的帧数
+    size_t advance(size_t new_seq) {
+        skipped = ((seq > 0) && (new_seq > seq + 1)) ? (new_seq - seq - 1) : 0;
+        dropped += skipped;
+        seq = new_seq;
+        return skipped;
+    }
+
+    //读者的中止标志置位后，阻塞读不再等待，没有新数据时返回T()
+    bool aborted() const {
+        return abort && abort->load();
+    }
+
+    size_t seq;         //上次读到的序号
+    size_t skipped;     //上次读取跳过的帧数
+    size_t dropped;     //累计跳过的帧数
+    int consumer;       //在BroadcastRing上登记的消费者编号，-1表示还没有登记
+    const void* owner;  //consumer所属的缓冲
+    const std::atomic<bool>* abort;     //读者的中止标志，先置位再调用缓冲的wake()
+};
+
 template<typename T>
 class RingBuffer
 {
 public:
-    RingBuffer(size_t deep, const std::string& buff_name = std::string()) : deep_(deep), wptr_(0), buff_name_(buff_name) {}
+    RingBuffer(size_t deep, const std::string& buff_name = std::string()) : deep_(deep), wptr_(0), overwritten_(0), buff_name_(buff_name) {}
 
-    void put(T value) {
+    void put(const T& value) {
         std::unique_lock<std::mutex> lock(mutex_);
 
         if (buff_.size() < deep_) {
             buff_.push_back(value);
+            read_.push_back(0);
         } else {
-            buff_[wptr_ % deep_] = value;
+            size_t index = wptr_ % deep_;
+            if (!read_[index]) {
+                overwritten_.fetch_add(1, std::memory_order_relaxed);
+            }
+            buff_[index] = value;
+            read_[index] = 0;
         }
         
         cond_.notify_all();
@@ -41,14 +75,95 @@ public:
             cond_.wait(lock);
         }
 
-        return buff_[(wptr_ - 1) % deep_];
+        return latest();
     }
 
     T get_sync() {
         std::unique_lock<std::mutex> lock(mutex_);
-        cond_.wait(lock);
+        size_t seen = wptr_;
+        while(wptr_ == seen) {
+            cond_.wait(lock);
+        }
+
+        return latest();
+    }
+
+    //阻塞直到有比cursor.seq更新的数据，返回最新的一帧，跳过的帧数记在游标里
+    T get_sync(ReadCursor& cursor) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(wptr_ <= cursor.seq) {
+            if (cursor.aborted()) {
+                return T();
+            }
+            cond_.wait(lock);
+        }
+
+        cursor.advance(wptr_);
+        return latest();
+    }
+
+    //不等待新数据，直接返回最新的一帧(缓冲为空时等待第一帧)
+    T get_async(ReadCursor& cursor) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(buff_.empty()) {
+            if (cursor.aborted()) {
+                return T();
+            }
+            cond_.wait(lock);
+        }
 
-        return buff_[(wptr_ - 1) % deep_];
+        if (wptr_ > cursor.seq) {
+            cursor.advance(wptr_);
+        }
+        return latest();
+    }
+
+    //非阻塞版本的get_sync，没有比cursor.seq更新的数据时返回false
+    bool try_get_sync(ReadCursor& cursor, T* value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (wptr_ <= cursor.seq) {
+            return false;
+        }
+
+        cursor.advance(wptr_);
+        *value = latest();
+        return true;
+    }
+
+    //非阻塞版本的get_async，缓冲为空时返回false
+    bool try_get_async(ReadCursor& cursor, T* value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (buff_.empty()) {
+            return false;
+        }
+
+        if (wptr_ > cursor.seq) {
+            cursor.advance(wptr_);
+        }
+        *value = latest();
+        return true;
+    }
+
+    //没有消费者登记，只清掉游标
+    void unsubscribe(ReadCursor& cursor) {
+        cursor.consumer = -1;
+        cursor.owner = nullptr;
+    }
+
+    //唤醒所有阻塞的读者，让置位了中止标志的游标返回
+    void wake() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+
+    size_t wptr() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return wptr_;
+    }
+
+    //没有被任何读者读过就被覆盖的帧数，不加锁，采集指标时不和put/get抢mutex_
+    size_t overwritten() {
+        return overwritten_.load(std::memory_order_relaxed);
     }
 
     std::string name() {
@@ -56,11 +171,21 @@ public:
     }
 
 
+protected:
+    //调用者持有mutex_
+    const T& latest() {
+        size_t index = (wptr_ - 1) % deep_;
+        read_[index] = 1;
+        return buff_[index];
+    }
+
 protected:
     size_t deep_;
     size_t wptr_;
+    std::atomic<size_t> overwritten_;
     std::string buff_name_;
     std::vector<T> buff_;
+    std::vector<char> read_;
     std::condition_variable cond_;
     std::mutex mutex_;
 
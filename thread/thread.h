@@ -5,18 +5,54 @@
 #include <condition_variable>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <glog/logging.h>
 
 namespace duck {
 namespace thread {
 
 
+//线程的调度策略，在线程进入process()之前生效
+struct SchedPolicy
+{
+    SchedPolicy() : policy(SCHED_OTHER), priority(0), nice(0), numa_node(-1) {}
+
+    std::vector<int> cpus;  //绑定的cpu，空表示不绑核
+    int policy;             //SCHED_OTHER, SCHED_FIFO, SCHED_RR
+    int priority;           //SCHED_FIFO/SCHED_RR的实时优先级，1~99
+    int nice;               //SCHED_OTHER的nice值，-20~19
+    int numa_node;          //节点缓冲池所在的NUMA节点，-1表示不指定
+
+    static std::string policy_name(int policy) {
+        switch(policy)
+        {
+            case SCHED_OTHER:
+                return "OTHER";
+            case SCHED_FIFO:
+                return "FIFO";
+            case SCHED_RR:
+                return "RR";
+            default:
+                return std::to_string(policy);
+        }
+    }
+};
 
 
 class Thread
 {
 public:
-    Thread(const std::string& thread_name) : thread_name_(thread_name), running_(false) {}
+    Thread(const std::string& thread_name) : thread_name_(thread_name), running_(false), tid_(0) {}
 
     virtual void process() = 0;
 
@@ -43,8 +79,95 @@ public:
         return running_;
     }
 
+    //设置调度策略，必须在start()之前调用
+    void set_sched_policy(const SchedPolicy& sched_policy) {
+        sched_policy_ = sched_policy;
+    }
+
+    SchedPolicy& sched_policy() {
+        return sched_policy_;
+    }
+
+    //线程实际的调度情况：绑定的cpu、调度策略、优先级和nice值。线程没有运行时返回配置值
+    std::string placement() {
+        std::stringstream ss;
+        if (!is_running() || !thread_.joinable()) {
+            ss << "cpus=" << cpus_string(sched_policy_.cpus) << " policy=" << SchedPolicy::policy_name(sched_policy_.policy) 
+                << " prio=" << sched_policy_.priority << " nice=" << sched_policy_.nice << " (not started)";
+            return ss.str();
+        }
+
+        pthread_t handle = thread_.native_handle();
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        std::vector<int> cpus;
+        if (pthread_getaffinity_np(handle, sizeof(cpu_set), &cpu_set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &cpu_set)) {
+                    cpus.push_back(i);
+                }
+            }
+        }
+
+        int policy = SCHED_OTHER;
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        pthread_getschedparam(handle, &policy, &param);
+
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, tid_);
+        ss << "cpus=" << cpus_string(cpus) << " policy=" << SchedPolicy::policy_name(policy) 
+            << " prio=" << param.sched_priority << " nice=" << ((errno == 0) ? nice : 0);
+        return ss.str();
+    }
+
 protected:
+    //在线程自己的上下文里应用调度策略，失败(例如没有CAP_SYS_NICE)只打印警告
+    void apply_sched_policy() {
+        tid_ = syscall(SYS_gettid);
+        pthread_setname_np(pthread_self(), name().substr(0, 15).c_str());
+
+        if (!sched_policy_.cpus.empty()) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (const auto cpu : sched_policy_.cpus) {
+                CPU_SET(cpu, &cpu_set);
+            }
+            int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+            if (ret != 0) {
+                LOG(WARNING) << name() << " set cpu affinity " << cpus_string(sched_policy_.cpus) << " failed: " << strerror(ret);
+            }
+        }
+
+        if ((sched_policy_.policy == SCHED_FIFO) || (sched_policy_.policy == SCHED_RR)) {
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = sched_policy_.priority;
+            int ret = pthread_setschedparam(pthread_self(), sched_policy_.policy, &param);
+            if (ret != 0) {
+                LOG(WARNING) << name() << " set sched policy " << SchedPolicy::policy_name(sched_policy_.policy) 
+                    << " priority " << sched_policy_.priority << " failed: " << strerror(ret);
+            }
+        } else if (sched_policy_.nice != 0) {
+            if (setpriority(PRIO_PROCESS, tid_, sched_policy_.nice) != 0) {
+                LOG(WARNING) << name() << " set nice " << sched_policy_.nice << " failed: " << strerror(errno);
+            }
+        }
+    }
+
+    static std::string cpus_string(const std::vector<int>& cpus) {
+        if (cpus.empty()) {
+            return "all";
+        }
+        std::stringstream ss;
+        for (size_t i = 0; i < cpus.size(); i++) {
+            ss << ((i > 0) ? "," : "") << cpus[i];
+        }
+        return ss.str();
+    }
+
     static void thread_handle(Thread* thread) {
+        thread->apply_sched_policy();
         LOG(INFO) << thread->name() << " thread is running!";
         thread->set_running(true);
         thread->process();
@@ -55,7 +178,9 @@ protected:
 protected:
     std::string thread_name_;
     std::thread thread_;
-    bool running_;
+    std::atomic<bool> running_;
+    SchedPolicy sched_policy_;
+    pid_t tid_;
 };
 
 
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <functional>
+#include <glog/logging.h>
+
+
+namespace duck {
+namespace thread {
+
+
+//一个节点处理一帧的记录，时间是steady_clock的纳秒
+struct TraceEvent
+{
+    size_t pipe_data_id;
+    uint16_t stream_id;         //经过MuxNode后各路的pipe_data_id会重复，用它区分
+    uint16_t node_id;
+    uint16_t node_gen;          //node_id会被后来的节点复用，用代数区分
+    uint16_t prev_node_id;      //上游节点，kNoNode表示根节点
+    uint16_t prev_node_gen;
+    int64_t prev_start_ns;      //上游compute()开始的时间，用于画流向箭头
+    int64_t prev_enqueue_ns;    //上游放进输出缓冲的时间
+    int64_t dequeue_ns;
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+//帧时间线记录器，输出Chrome Trace Event JSON(chrome://tracing和Perfetto都可以打开)。
+//每个线程第一次记录时登记一块自己的定长缓冲，之后记录只写本线程的缓冲，不加锁；
+//线程退出时缓冲还回来(已记录的事件保留)，后来的线程接着写，节点反复重启或者开副本也不会一直分配新的缓冲。
+//缓冲写满后丢弃新的事件并计数，内存上限是 同时记录过的线程数 * capacity * sizeof(TraceEvent)。
+//start()/stop()可以在运行时随时调用，write_json()在stop()之后导出。
+class TraceRecorder
+{
+public:
+    static const uint16_t kNoNode = 0xffff;
+
+    static TraceRecorder& instance() {
+        static TraceRecorder recorder;
+        return recorder;
+    }
+
+    //开始一段新的记录，清空之前的事件。capacity是每个线程最多记录的事件数
+    void start(size_t capacity = 65536) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        quiesce();
+        capacity_ = (capacity > 0) ? capacity : 1;
+        for (auto& buffer : buffers_) {
+            buffer->events.reset(new TraceEvent[capacity_]);
+            buffer->capacity = capacity_;
+            buffer->count.store(0);
+            buffer->dropped.store(0);
+        }
+        epoch_ns_ = now_ns();
+        enabled_.store(true);
+    }
+
+    void stop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        quiesce();
+    }
+
+    bool enabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    void record(const TraceEvent& event) {
+        if (!enabled()) {
+            return;
+        }
+
+        Buffer* buffer = local_buffer();
+        //和quiesce()配对：stop()之后不会再有写者在写缓冲
+        buffer->busy.store(true);
+        if (enabled_.load()) {
+            size_t count = buffer->count.load(std::memory_order_relaxed);
+            if (count < buffer->capacity) {
+                buffer->events[count] = event;
+                buffer->count.store(count + 1, std::memory_order_release);
+            } else {
+                buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        buffer->busy.store(false, std::memory_order_release);
+    }
+
+    size_t event_count() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t count = 0;
+        for (auto& buffer : buffers_) {
+            count += buffer->count.load(std::memory_order_acquire);
+        }
+        return count;
+    }
+
+    //缓冲写满后丢弃的事件数
+    size_t dropped_count() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t dropped = 0;
+        for (auto& buffer : buffers_) {
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
+
+    //每个节点一条轨道(tid = node_gen << 16 | node_id)，compute()画成完整事件，在上游缓冲里等待的时间画成异步事件，
+    //同一路的同一个pipe_data_id从上游到下游用流向箭头连起来。track_name(node_id, node_gen)返回轨道名
+    bool write_json(const std::string& path, std::function<std::string(uint16_t, uint16_t)> track_name) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        quiesce();
+
+        std::ofstream file(path.c_str());
+        if (!file) {
+            LOG(ERROR) << "open trace file " << path << " failed!";
+            return false;
+        }
+
+        std::set<uint32_t> named;
+        bool first = true;
+        file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        for (auto& buffer : buffers_) {
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                const TraceEvent& event = buffer->events[i];
+                if (named.insert(track_id(event.node_id, event.node_gen)).second) {
+                    separator(file, first);
+                    file << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << track_id(event.node_id, event.node_gen)
+                        << ",\"args\":{\"name\":\"" << track_name(event.node_id, event.node_gen) << "\"}}";
+                }
+                write_event(file, first, event);
+            }
+        }
+        file << "\n]}\n";
+        return file.good();
+    }
+
+protected:
+    struct Buffer
+    {
+        Buffer() : capacity(0), count(0), dropped(0), busy(false), owned(false) {}
+
+        std::unique_ptr<TraceEvent[]> events;
+        size_t capacity;
+        std::atomic<size_t> count;
+        std::atomic<size_t> dropped;
+        std::atomic<bool> busy;
+        bool owned;                 //有线程在用，由mutex_保护
+    };
+
+    //线程退出时把缓冲还给记录器
+    struct LocalBuffer
+    {
+        LocalBuffer() : recorder(nullptr), buffer(nullptr) {}
+
+        ~LocalBuffer() {
+            if (buffer) {
+                recorder->release(buffer);
+            }
+        }
+
+        TraceRecorder* recorder;
+        Buffer* buffer;
+    };
+
+    TraceRecorder() : capacity_(65536), epoch_ns_(0), enabled_(false) {}
+
+    static int64_t now_ns() {
+        auto now = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    }
+
+    //关闭记录并等待正在写的线程离开，调用者持有mutex_
+    void quiesce() {
+        enabled_.store(false);
+        for (auto& buffer : buffers_) {
+            while(buffer->busy.load()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    //本线程的缓冲，只在线程第一次记录时加锁登记，优先用已退出线程还回来的
+    Buffer* local_buffer() {
+        static thread_local LocalBuffer local;
+        if (!local.buffer) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (auto& buffer : buffers_) {
+                if (!buffer->owned) {
+                    local.buffer = buffer.get();
+                    break;
+                }
+            }
+            if (!local.buffer) {
+                std::unique_ptr<Buffer> created(new Buffer);
+                created->events.reset(new TraceEvent[capacity_]);
+                created->capacity = capacity_;
+                local.buffer = created.get();
+                buffers_.push_back(std::move(created));
+            }
+            local.buffer->owned = true;
+            local.recorder = this;
+        }
+        return local.buffer;
+    }
+
+    void release(Buffer* buffer) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        buffer->owned = false;
+    }
+
+    double to_us(int64_t ns) {
+        return (ns - epoch_ns_) / 1000.0;
+    }
+
+    static uint32_t track_id(uint16_t node_id, uint16_t node_gen) {
+        return ((uint32_t)node_gen << 16) | node_id;
+    }
+
+    static void separator(std::ofstream& file, bool& first) {
+        if (!first) {
+            file << ",\n";
+        }
+        first = false;
+    }
+
+    void write_event(std::ofstream& file, bool& first, const TraceEvent& event) {
+        //pipe_data_id取低32位，按30fps要四年多才会重复
+        unsigned long long flow_id = ((unsigned long long)(event.pipe_data_id & 0xffffffffu) << 32)
+            | ((unsigned long long)event.stream_id << 16) | event.node_id;
+
+        separator(file, first);
+        file << "{\"ph\":\"X\",\"cat\":\"compute\",\"name\":\"frame " << event.pipe_data_id << "\",\"pid\":1,\"tid\":" << track_id(event.node_id, event.node_gen)
+            << ",\"ts\":" << to_us(event.start_ns) << ",\"dur\":" << (event.end_ns - event.start_ns) / 1000.0
+            << ",\"args\":{\"pipe_data_id\":" << event.pipe_data_id << ",\"stream_id\":" << event.stream_id << "}}";
+
+        if (event.prev_node_id == kNoNode) {
+            return;
+        }
+
+        separator(file, first);
+        file << "{\"ph\":\"b\",\"cat\":\"queue\",\"name\":\"queue\",\"id\":" << flow_id << ",\"pid\":1,\"tid\":" << track_id(event.node_id, event.node_gen)
+            << ",\"ts\":" << to_us(event.prev_enqueue_ns) << "}";
+        separator(file, first);
+        file << "{\"ph\":\"e\",\"cat\":\"queue\",\"name\":\"queue\",\"id\":" << flow_id << ",\"pid\":1,\"tid\":" << track_id(event.node_id, event.node_gen)
+            << ",\"ts\":" << to_us(event.dequeue_ns) << "}";
+
+        separator(file, first);
+        file << "{\"ph\":\"s\",\"cat\":\"flow\",\"name\":\"frame\",\"id\":" << flow_id << ",\"pid\":1,\"tid\":" << track_id(event.prev_node_id, event.prev_node_gen)
+            << ",\"ts\":" << to_us(event.prev_start_ns) << "}";
+        separator(file, first);
+        file << "{\"ph\":\"f\",\"bp\":\"e\",\"cat\":\"flow\",\"name\":\"frame\",\"id\":" << flow_id << ",\"pid\":1,\"tid\":" << track_id(event.node_id, event.node_gen)
+            << ",\"ts\":" << to_us(event.start_ns) << "}";
+    }
+
+protected:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer> > buffers_;
+    size_t capacity_;
+    int64_t epoch_ns_;
+    std::atomic<bool> enabled_;
+};
+
+
+}//namespace thread
+}//namespace duck
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <glog/logging.h>
+
+#include "thread/executor.h"
+
+
+namespace duck {
+namespace timer {
+
+
+enum TimerFlag
+{
+    TIMER_CATCH_UP = 0x1,       //错过的周期连续补触发，默认直接跳到下一个未来的周期
+    TIMER_DISPATCH = 0x2,       //回调投递到TimerManager的executor上执行，不占用定时器线程
+};
+
+inline int64_t steady_now_us() {
+    auto now = std::chrono::steady_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch());
+    return duration.count();
+}
+
+//定时器，时间单位是steady_clock的微秒。周期是锚定的：下一次到期 = 上一次到期 + 周期，
+//回调执行的时间不会累积成漂移。
+class Timer : public duck::thread::Task
+{
+public:
+    Timer() : period_us_(0), repeat_(0), flags_(0), expire_(0), cancelled_(false), finished_(false), in_flight_(false),
+        firing_(0), fire_expire_(0), fired_(0), overruns_(0), armed_(false), prev_(nullptr), next_(nullptr), list_(nullptr) {}
+    Timer(int64_t period_us, int repeat, int flags, std::function<void()> func)
+        : period_us_((period_us > 0) ? period_us : 1), repeat_(repeat), flags_(flags), func_(func), expire_(0), cancelled_(false), finished_(false), in_flight_(false),
+        firing_(0), fire_expire_(0), fired_(0), overruns_(0), armed_(false), prev_(nullptr), next_(nullptr), list_(nullptr) {}
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    int64_t now_us() {
+        return steady_now_us();
+    }
+
+    //本次到期之后的下一个到期时间，错过的周期按flags_补触发或者跳过
+    int64_t next_expire(int64_t now) {
+        int64_t next = expire_ + period_us_;
+        if ((next <= now) && !(flags_ & TIMER_CATCH_UP)) {
+            int64_t missed = (now - expire_) / period_us_;
+            overruns_.fetch_add(missed, std::memory_order_relaxed);
+            next = expire_ + (missed + 1) * period_us_;
+        }
+        return next;
+    }
+
+    //在executor上执行回调，由TimerManager投递
+    virtual void run() {
+        std::shared_ptr<Timer> keep;
+        keep.swap(in_flight_self_);
+        invoke();
+        in_flight_.store(false, std::memory_order_release);
+    }
+
+    //执行一次回调。先登记再检查取消标志，和wait_idle()里先置标志再看登记配对(都是seq_cst)，
+    //两边至少有一方看到对方：要么这里看到已取消不执行，要么wait_idle()等到回调结束
+    void invoke() {
+        Timer*& current = t_firing();
+        Timer* outer = current;
+        current = this;
+        firing_.fetch_add(1);
+        if (!cancelled_.load()) {
+            func_();
+        }
+        firing_.fetch_sub(1, std::memory_order_release);
+        current = outer;
+    }
+
+    //当前线程正在执行的回调是哪一次到期触发的，不在定时器回调里时返回0。
+    //周期定时器据此算唤醒延迟，不受错过的周期和回调排队的影响
+    static int64_t firing_expire_us() {
+        Timer* timer = t_firing();
+        return timer ? timer->fire_expire_.load(std::memory_order_relaxed) : 0;
+    }
+
+    //等正在执行的回调结束，必须在取消标志置位之后调用。在本定时器自己的回调里调用时直接返回
+    void wait_idle() {
+        if (t_firing() == this) {
+            return;
+        }
+        while(firing_.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    int64_t expire() {
+        return expire_;
+    }
+
+    void set_expire(int64_t expire) {
+        expire_ = expire;
+    }
+
+    int64_t period_us() {
+        return period_us_;
+    }
+
+    int flags() {
+        return flags_;
+    }
+
+    bool cancelled() {
+        return cancelled_.load(std::memory_order_acquire);
+    }
+
+    bool finished() {
+        return finished_.load(std::memory_order_acquire);
+    }
+
+    //已经触发的次数
+    int64_t fired_count() {
+        return fired_.load(std::memory_order_relaxed);
+    }
+
+    //被跳过的周期数：SKIP模式下错过的周期，以及DISPATCH模式下上一次回调还没执行完的周期
+    int64_t overrun_count() {
+        return overruns_.load(std::memory_order_relaxed);
+    }
+
+protected:
+    //当前线程正在执行的定时器回调
+    static Timer*& t_firing() {
+        static thread_local Timer* timer = nullptr;
+        return timer;
+    }
+
+    friend class MapTimerEngine;
+    friend class TimingWheel;
+    friend class TimerManager;
+    friend class TimerHandle;
+
+    int64_t period_us_;
+    int repeat_;
+    int flags_;
+    std::function<void()> func_;
+    int64_t expire_;
+    std::atomic<bool> cancelled_;
+    std::atomic<bool> finished_;
+    std::atomic<bool> in_flight_;
+    std::atomic<int> firing_;          //正在执行回调的线程数
+    std::atomic<int64_t> fire_expire_; //最近一次触发的到期时间，回调投递到executor时expire_已经被改成下一次的
+    std::atomic<int64_t> fired_;
+    std::atomic<int64_t> overruns_;
+
+    //以下只由定时器线程访问。self_在定时器挂在引擎上期间持有自己，结束或取消时释放
+    bool armed_;
+    std::shared_ptr<Timer> self_;
+    //回调投递到executor期间持有自己，run()开始时接管
+    std::shared_ptr<Timer> in_flight_self_;
+
+    //定时器引擎使用的侵入式挂载点，避免每次触发重新分配
+    Timer* prev_;
+    Timer* next_;
+    Timer** list_;
+    std::multimap<int64_t, Timer*>::iterator map_it_;
+};
+
+
+}//namespace timer
+}//namespace duck
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <glog/logging.h>
+
+#include "timer/timer.h"
+
+
+namespace duck {
+namespace timer {
+
+
+enum TimerEngineType
+{
+    TIMER_ENGINE_MAP = 0,       //std::multimap，O(log n)
+    TIMER_ENGINE_WHEEL,         //分层时间轮，O(1)。槽粒度是tick_ms，到期时间仍然精确到微秒
+};
+
+//定时器的存储结构。TimerManager持有锁调用，引擎本身不做同步
+class TimerEngine
+{
+public:
+    virtual ~TimerEngine() {}
+
+    virtual void add(Timer* timer) = 0;
+    virtual void remove(Timer* timer) = 0;
+
+    //取出一个在now之前到期的定时器，没有则返回nullptr
+    virtual Timer* pop_expired(int64_t now) = 0;
+
+    //下一次需要醒来的时间，没有定时器时返回-1。时间轮在当前tick之外返回的是一个下界
+    virtual int64_t next_expire() = 0;
+
+    virtual size_t size() = 0;
+
+    //取出所有定时器，用于析构
+    virtual void collect(std::vector<Timer*>& timers) = 0;
+};
+
+
+class MapTimerEngine : public TimerEngine
+{
+public:
+    void add(Timer* timer) {
+        timer->map_it_ = timer_map_.insert(std::make_pair(timer->expire(), timer));
+    }
+
+    void remove(Timer* timer) {
+        timer_map_.erase(timer->map_it_);
+    }
+
+    Timer* pop_expired(int64_t now) {
+        if (timer_map_.empty()) {
+            return nullptr;
+        }
+
+        auto it = timer_map_.begin();
+        if (it->first > now) {
+            return nullptr;
+        }
+
+        Timer* timer = it->second;
+        timer_map_.erase(it);
+        return timer;
+    }
+
+    int64_t next_expire() {
+        if (timer_map_.empty()) {
+            return -1;
+        }
+        return timer_map_.begin()->first;
+    }
+
+    size_t size() {
+        return timer_map_.size();
+    }
+
+    void collect(std::vector<Timer*>& timers) {
+        for (const auto& it : timer_map_) {
+            timers.push_back(it.second);
+        }
+        timer_map_.clear();
+    }
+
+protected:
+    std::multimap<int64_t, Timer*> timer_map_;
+};
+
+
+}//namespace timer
+}//namespace duck
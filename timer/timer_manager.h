@@ -9,153 +9,253 @@
 #include <thread>
 #include <chrono>
 #include <functional>
+#include <memory>
+#include <vector>
+#include <atomic>
 #include <glog/logging.h>
 
+#include "thread/mpsc_queue.h"
+#include "timer/timer.h"
+#include "timer/timer_engine.h"
+#include "timer/timing_wheel.h"
+
 
 namespace duck {
 namespace timer {
 
 
-class Timer
+class TimerManager;
+
+//submit()返回的定时器句柄，可以在任意线程取消或重新设置周期。
+//句柄不能在TimerManager析构之后使用。
+class TimerHandle
 {
 public:
-    Timer() : period_ms_(0), repeat_(0) {}
-    Timer(int64_t period_ms, int repeat, std::function<void()> func) : period_ms_(period_ms), repeat_(repeat), func_(func) {}
+    TimerHandle() : manager_(nullptr) {}
+    TimerHandle(TimerManager* manager, const std::shared_ptr<Timer>& timer) : manager_(manager), timer_(timer) {}
 
-    int64_t now_ms() {
-        auto now = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
-        int64_t ms = duration.count();
-        return ms;
+    //取消定时器，返回后回调不会再开始执行，已经在执行的回调也已经结束，调用者可以释放回调用到的对象。
+    //在本定时器自己的回调里取消时不等待；不能持着回调里要获取的锁调用
+    inline bool cancel();
+
+    //修改周期，下一次在delay_us之后触发，delay_us小于0表示一个新周期之后
+    inline bool reschedule_us(int64_t period_us, int64_t delay_us = -1);
+
+    inline bool reschedule(int64_t period_ms, int64_t delay_ms = -1);
+
+    bool valid() {
+        return (manager_ != nullptr) && (timer_ != nullptr);
     }
 
-    int64_t process() {
- 
-        int64_t now = now_ms();
-        if (repeat_ != 0) {
-            func_();
-        }
-        if (repeat_ > 0) {
-            repeat_--;
-        } 
+    bool active() {
+        return valid() && !timer_->cancelled() && !timer_->finished();
+    }
 
-        if (repeat_ == 0) {
-            return -1;
-        }
+    int64_t fired_count() {
+        return valid() ? timer_->fired_count() : 0;
+    }
 
-        now += period_ms_;
-        return now;
+    int64_t overrun_count() {
+        return valid() ? timer_->overrun_count() : 0;
     }
 
-   
+    void reset() {
+        manager_ = nullptr;
+        timer_.reset();
+    }
 
 protected:
-    int64_t period_ms_;
-    int repeat_;
-    std::function<void()> func_;
+    TimerManager* manager_;
+    std::shared_ptr<Timer> timer_;
 };
 
+//提交给定时器线程的命令，经过无锁的MPSC队列传递
+struct TimerCommand
+{
+    enum
+    {
+        TIMER_ADD = 0,
+        TIMER_CANCEL,
+        TIMER_RESCHEDULE,
+    };
+
+    TimerCommand() : type(TIMER_ADD), period_us(0), delay_us(0) {
+        next_.store(nullptr);
+    }
 
+    std::atomic<TimerCommand*> next_;
+    int type;
+    std::shared_ptr<Timer> timer;
+    int64_t period_us;
+    int64_t delay_us;
+};
 
 
+//定时器管理，时间精度为steady_clock的微秒，tick_ms只决定时间轮的槽粒度。
+//定时器引擎只由定时器线程访问，其他线程的submit/cancel/reschedule都通过无锁的inbox_投递，
+//生产者从不阻塞在定时器线程持有的锁上；mutex_只用于定时器线程挂起时的唤醒。
 class TimerManager
 {
 public:
-    TimerManager(int tick_ms = 5) : tick_ms_(tick_ms), quit_(true) {}
+    TimerManager(int tick_ms = 5, int engine_type = TIMER_ENGINE_MAP) : tick_ms_(tick_ms), engine_type_(engine_type), executor_(nullptr), quit_(true), sleeping_(false), pending_(0), count_(0) {
+        switch(engine_type_)
+        {
+            case TIMER_ENGINE_MAP:
+                engine_.reset(new MapTimerEngine());
+                break;
+            case TIMER_ENGINE_WHEEL:
+                engine_.reset(new TimingWheel((int64_t)tick_ms_ * 1000, now_us()));
+                break;
+            default:
+                LOG(FATAL) << "unknown timer engine type: " << engine_type_;
+        }
+    }
+
+    ~TimerManager() {
+        stop();
+
+        while(TimerCommand* command = inbox_.pop()) {
+            delete command;
+        }
+
+        std::vector<Timer*> timers;
+        engine_->collect(timers);
+        for (const auto timer : timers) {
+            timer->armed_ = false;
+            timer->self_.reset();
+        }
+    }
 
     int64_t now_ms() {
-        auto now = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
-        int64_t ms = duration.count();
-        return ms;
+        return now_us() / 1000;
     }
 
-    
-    template<typename F, typename... Args>
-    void submit(int64_t period_ms, int repeat, F && func, Args&&... args) {
+    int64_t now_us() {
+        return steady_now_us();
+    }
 
-        std::unique_lock<std::mutex> lock(mutex_);
+    //设置TIMER_DISPATCH定时器使用的线程池，没有设置时回调仍然在定时器线程上执行。必须在start()之前调用
+    void set_executor(duck::thread::Executor* executor) {
+        executor_ = executor;
+    }
+
+    //微秒周期的定时器，flags是TimerFlag的组合，第一次在提交后立即触发
+    template<typename F, typename... Args>
+    TimerHandle submit_us(int64_t period_us, int repeat, int flags, F && func, Args&&... args) {
 
         auto ff = std::bind(std::forward<F>(func), std::forward<Args>(args)...);
         
-        Timer timer(period_ms, repeat, ff);
-        int64_t now = now_ms(); 
-        timer_map_.insert(std::make_pair(now, timer));
+        std::shared_ptr<Timer> timer(new Timer(period_us, repeat, flags, ff));
+        timer->set_expire(now_us());
+        post(TimerCommand::TIMER_ADD, timer);
+        return TimerHandle(this, timer);
+    }
+    
+    template<typename F, typename... Args>
+    TimerHandle submit(int64_t period_ms, int repeat, F && func, Args&&... args) {
+
+        return submit_us(period_ms * 1000, repeat, 0, std::forward<F>(func), std::forward<Args>(args)...);
     }
 
     template<typename F, typename... Args>
-    void submit(int64_t period_ms, F && func, Args&&... args) {
+    TimerHandle submit(int64_t period_ms, F && func, Args&&... args) {
         
-        submit(period_ms, -1, std::forward<F>(func), std::forward<Args>(args)...); 
+        return submit(period_ms, -1, std::forward<F>(func), std::forward<Args>(args)...); 
+    }
+
+    //投递一个命令给定时器线程，任意线程可调用，不会阻塞
+    void post(int type, const std::shared_ptr<Timer>& timer, int64_t period_us = 0, int64_t delay_us = 0) {
+        if (type == TimerCommand::TIMER_CANCEL) {
+            timer->cancelled_.store(true);
+        }
+
+        TimerCommand* command = new TimerCommand();
+        command->type = type;
+        command->timer = timer;
+        command->period_us = period_us;
+        command->delay_us = delay_us;
+        inbox_.push(command);
+
+        pending_.fetch_add(1);
+        if (sleeping_.load()) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.notify_one();
+        }
     }
 
+    //定时器线程：处理inbox_中的命令，执行所有到期的定时器，然后一直睡到下一个到期时间
     void process() {
-        
+
         while(!quit_)
         {
-            std::chrono::milliseconds ms(tick_ms_);
-            std::this_thread::sleep_for(ms);
-
             update();
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (quit_) {
+                break;
+            }
+
+            sleeping_.store(true);
+            if (pending_.load() == 0) {
+                int64_t next_time = engine_->next_expire();
+                if (next_time < 0) {
+                    cond_.wait(lock);
+                } else if (next_time > now_us()) {
+                    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point(std::chrono::microseconds(next_time));
+                    cond_.wait_until(lock, deadline);
+                }
+            }
+            sleeping_.store(false);
         }
     }
 
     void update()
     {
+        drain();
+
+        int64_t now = now_us();
         while(!quit_)
         {
-            Timer timer;
-            int ret = pop(&timer);
-            if (ret < 0) {
+            Timer* timer = engine_->pop_expired(now);
+            if (!timer) {
                 return;
             }
+            timer->armed_ = false;
 
-            int64_t next_time = timer.process();
-            if (next_time > 0) {
-                push(next_time, timer);
+            if ((timer->repeat_ != 0) && !timer->cancelled()) {
+                fire(timer);
+                now = now_us();
+            }
+            if (timer->repeat_ > 0) {
+                timer->repeat_--;
             }
-        }
-    }
-
-
-    int pop(Timer* timer) {
-        std::unique_lock<std::mutex> lock(mutex_);
-
-        if (timer_map_.empty()) {
-            return -1;
-        }
-
-        int64_t now = now_ms();
 
-        auto it = timer_map_.begin();
-        if (it->first > now) {
-            return -1;
+            if ((timer->repeat_ != 0) && !timer->cancelled()) {
+                timer->set_expire(timer->next_expire(now));
+                arm(timer);
+            } else {
+                disarm(timer);
+            }
         }
-  
-        *timer = it->second;
-        timer_map_.erase(it);
-
-        return 0;
     }
 
-    void push(int64_t next_time, Timer timer) {
-
-        std::unique_lock<std::mutex> lock(mutex_);
-
-        timer_map_.insert(std::make_pair(next_time, timer));
-
+    //当前挂在定时器线程上的定时器个数
+    size_t size() {
+        return count_.load(std::memory_order_relaxed);
     }
 
 
-    
-
     void start() {
         quit_ = false;
         thread_ = std::thread(TimerManager::thread_handle, this);
     }
 
     void stop() {
-        quit_ = true;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            quit_ = true;
+            cond_.notify_all();
+        }
         if (thread_.joinable()) {
             thread_.join();
         }
@@ -166,17 +266,118 @@ public:
         manager->process();
     }
 
+protected:
+    void fire(Timer* timer) {
+        timer->fired_.fetch_add(1, std::memory_order_relaxed);
+
+        if (!(timer->flags_ & TIMER_DISPATCH) || !executor_) {
+            timer->fire_expire_.store(timer->expire_, std::memory_order_relaxed);
+            timer->invoke();
+            return;
+        }
+
+        //上一次投递的回调还没执行完，本周期算作overrun，不并发执行同一个回调
+        if (timer->in_flight_.load(std::memory_order_acquire)) {
+            timer->overruns_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        timer->fire_expire_.store(timer->expire_, std::memory_order_relaxed);
+        timer->in_flight_.store(true, std::memory_order_relaxed);
+        timer->in_flight_self_ = timer->self_;
+        executor_->submit(timer);
+    }
+
+    void drain() {
+        while(TimerCommand* command = inbox_.pop())
+        {
+            pending_.fetch_sub(1);
+            Timer* timer = command->timer.get();
+
+            switch(command->type)
+            {
+                case TimerCommand::TIMER_ADD:
+                    if (!timer->cancelled()) {
+                        timer->self_ = command->timer;
+                        arm(timer);
+                    }
+                    break;
+                case TimerCommand::TIMER_CANCEL:
+                    if (timer->armed_) {
+                        engine_->remove(timer);
+                        timer->armed_ = false;
+                    }
+                    disarm(timer);
+                    break;
+                case TimerCommand::TIMER_RESCHEDULE:
+                    if (timer->armed_) {
+                        engine_->remove(timer);
+                        timer->armed_ = false;
+                        timer->period_us_ = (command->period_us > 0) ? command->period_us : 1;
+                        timer->set_expire(now_us() + ((command->delay_us >= 0) ? command->delay_us : timer->period_us_));
+                        arm(timer);
+                    }
+                    break;
+                default:
+                    LOG(ERROR) << "unknown timer command: " << command->type;
+                    break;
+            }
+            delete command;
+        }
+    }
+
+    void arm(Timer* timer) {
+        engine_->add(timer);
+        timer->armed_ = true;
+        count_.store(engine_->size(), std::memory_order_relaxed);
+    }
+
+    //定时器结束或被取消，释放定时器线程持有的引用，可能会析构timer
+    void disarm(Timer* timer) {
+        timer->finished_.store(true, std::memory_order_release);
+        count_.store(engine_->size(), std::memory_order_relaxed);
+        timer->self_.reset();
+    }
+
 protected:
     int tick_ms_;
-    std::multimap<int64_t, Timer> timer_map_;
+    int engine_type_;
+    std::unique_ptr<TimerEngine> engine_;
+    duck::thread::Executor* executor_;
+    duck::thread::MpscQueue<TimerCommand> inbox_;
 
     
     std::thread thread_;
-    bool quit_;
+    std::atomic<bool> quit_;
+    std::atomic<bool> sleeping_;
+    std::atomic<int> pending_;
+    std::atomic<size_t> count_;
     std::mutex mutex_;
+    std::condition_variable cond_;
 };
 
 
+inline bool TimerHandle::cancel() {
+    if (!valid()) {
+        return false;
+    }
+    manager_->post(TimerCommand::TIMER_CANCEL, timer_);
+    timer_->wait_idle();
+    return true;
+}
+
+inline bool TimerHandle::reschedule_us(int64_t period_us, int64_t delay_us) {
+    if (!active()) {
+        return false;
+    }
+    manager_->post(TimerCommand::TIMER_RESCHEDULE, timer_, period_us, (delay_us >= 0) ? delay_us : -1);
+    return true;
+}
+
+inline bool TimerHandle::reschedule(int64_t period_ms, int64_t delay_ms) {
+    return reschedule_us(period_ms * 1000, (delay_ms >= 0) ? delay_ms * 1000 : -1);
+}
+
+
 }//namespace timer
 }//namespace duck
 
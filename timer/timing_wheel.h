@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "timer/timer.h"
+#include "timer/timer_engine.h"
+
+
+namespace duck {
+namespace timer {
+
+
+//分层时间轮：第0层256个槽，每槽一个tick；往上4层各64个槽，每层的一个槽覆盖下一层的一整圈，
+//总共可以表示2^32个tick。定时器侵入式地挂在槽的双向链表上，插入/删除/到期都是O(1)，
+//第0层转完一圈时把上一层对应的槽重新分散到下层(cascade)。
+//槽只决定什么时候去看一眼：定时器按到期时间向下取整放进槽，转到当前tick后先放在near_里，
+//到了各自精确的微秒到期时间才取出，next_expire()也返回这个精确时间，所以触发不会被对齐到tick上。
+class TimingWheel : public TimerEngine
+{
+public:
+    TimingWheel(int64_t tick, int64_t now) : tick_((tick > 0) ? tick : 1), current_(now / tick_), wheel_count_(0), expired_count_(0), near_(nullptr), expired_(nullptr) {
+        memset(l0_, 0, sizeof(l0_));
+        memset(ln_, 0, sizeof(ln_));
+        memset(bitmap_, 0, sizeof(bitmap_));
+    }
+
+    void add(Timer* timer) {
+        place(timer, timer->expire() / tick_);
+    }
+
+    void remove(Timer* timer) {
+        unlink(timer);
+    }
+
+    Timer* pop_expired(int64_t now) {
+        advance(now / tick_);
+        if (!expired_) {
+            promote(now);
+        }
+        if (!expired_) {
+            return nullptr;
+        }
+
+        Timer* timer = expired_;
+        unlink(timer);
+        return timer;
+    }
+
+    int64_t next_expire() {
+        if (expired_) {
+            return current_ * tick_;
+        }
+        if (near_) {
+            int64_t expire = near_->expire();
+            for (Timer* timer = near_->next_; timer; timer = timer->next_) {
+                expire = std::min(expire, timer->expire());
+            }
+            return expire;
+        }
+        if (wheel_count_ == 0) {
+            return -1;
+        }
+
+        //在第0层当前这一圈里找下一个非空槽，找不到就在下一次cascade时醒来
+        int index = (current_ & kL0Mask) + 1;
+        while(index < kL0Size)
+        {
+            uint64_t word = bitmap_[index / 64] >> (index % 64);
+            if (word) {
+                index += __builtin_ctzll(word);
+                return (current_ - (current_ & kL0Mask) + index) * tick_;
+            }
+            index = (index / 64 + 1) * 64;
+        }
+        return ((current_ | kL0Mask) + 1) * tick_;
+    }
+
+    size_t size() {
+        return wheel_count_ + expired_count_;
+    }
+
+    void collect(std::vector<Timer*>& timers) {
+        for (int i = 0; i < kL0Size; i++) {
+            collect_list(&l0_[i], timers);
+        }
+        for (int level = 0; level < kLevels; level++) {
+            for (int i = 0; i < kLnSize; i++) {
+                collect_list(&ln_[level][i], timers);
+            }
+        }
+        collect_list(&near_, timers);
+        collect_list(&expired_, timers);
+    }
+
+    int64_t tick() {
+        return tick_;
+    }
+
+protected:
+    static const int kL0Bits = 8;
+    static const int kL0Size = 1 << kL0Bits;
+    static const int64_t kL0Mask = kL0Size - 1;
+    static const int kLnBits = 6;
+    static const int kLnSize = 1 << kLnBits;
+    static const int64_t kLnMask = kLnSize - 1;
+    static const int kLevels = 4;
+
+    void place(Timer* timer, int64_t ticks) {
+        int64_t delta = ticks - current_;
+        if (delta <= 0) {
+            link(&near_, timer);
+            expired_count_++;
+            return;
+        }
+
+        if (delta < kL0Size) {
+            int index = ticks & kL0Mask;
+            link(&l0_[index], timer);
+            bitmap_[index / 64] |= (1ull << (index % 64));
+            wheel_count_++;
+            return;
+        }
+
+        int level = 0;
+        int shift = kL0Bits;
+        while((level < kLevels - 1) && (delta >= (1ll << (shift + kLnBits))))
+        {
+            level++;
+            shift += kLnBits;
+        }
+        if (delta >= (1ll << (shift + kLnBits))) {
+            //超出时间轮范围，先放到最远的槽里，cascade时会重新计算
+            ticks = current_ + (1ll << (shift + kLnBits)) - 1;
+        }
+        link(&ln_[level][(ticks >> shift) & kLnMask], timer);
+        wheel_count_++;
+    }
+
+    void advance(int64_t now_ticks) {
+        while(current_ < now_ticks)
+        {
+            if (wheel_count_ == 0) {
+                current_ = now_ticks;
+                break;
+            }
+
+            current_++;
+            int index = current_ & kL0Mask;
+            if (index == 0) {
+                for (int level = 0; level < kLevels; level++) {
+                    int level_index = (current_ >> (kL0Bits + level * kLnBits)) & kLnMask;
+                    cascade(&ln_[level][level_index]);
+                    if (level_index != 0) {
+                        break;
+                    }
+                }
+            }
+
+            Timer* timer = l0_[index];
+            while(timer)
+            {
+                Timer* next = timer->next_;
+                unlink(timer);
+                link(&near_, timer);
+                expired_count_++;
+                timer = next;
+            }
+        }
+    }
+
+    //把near_里已经到了精确到期时间的定时器移到expired_，只在expired_取空后扫一遍
+    void promote(int64_t now) {
+        Timer* timer = near_;
+        while(timer)
+        {
+            Timer* next = timer->next_;
+            if (timer->expire() <= now) {
+                unlink(timer);
+                link(&expired_, timer);
+                expired_count_++;
+            }
+            timer = next;
+        }
+    }
+
+    void cascade(Timer** list) {
+        Timer* timer = *list;
+        while(timer)
+        {
+            Timer* next = timer->next_;
+            unlink(timer);
+            place(timer, timer->expire() / tick_);
+            timer = next;
+        }
+    }
+
+    void link(Timer** list, Timer* timer) {
+        timer->list_ = list;
+        timer->prev_ = nullptr;
+        timer->next_ = *list;
+        if (*list) {
+            (*list)->prev_ = timer;
+        }
+        *list = timer;
+    }
+
+    void unlink(Timer* timer) {
+        Timer** list = timer->list_;
+        if (!list) {
+            return;
+        }
+
+        if (timer->prev_) {
+            timer->prev_->next_ = timer->next_;
+        } else {
+            *list = timer->next_;
+        }
+        if (timer->next_) {
+            timer->next_->prev_ = timer->prev_;
+        }
+        timer->prev_ = nullptr;
+        timer->next_ = nullptr;
+        timer->list_ = nullptr;
+
+        if ((list == &expired_) || (list == &near_)) {
+            expired_count_--;
+        } else {
+            wheel_count_--;
+            if ((list >= &l0_[0]) && (list < &l0_[kL0Size]) && !*list) {
+                int index = list - &l0_[0];
+                bitmap_[index / 64] &= ~(1ull << (index % 64));
+            }
+        }
+    }
+
+    void collect_list(Timer** list, std::vector<Timer*>& timers) {
+        while(*list)
+        {
+            Timer* timer = *list;
+            unlink(timer);
+            timers.push_back(timer);
+        }
+    }
+
+protected:
+    int64_t tick_;
+    int64_t current_;
+    size_t wheel_count_;
+    size_t expired_count_;
+    Timer* l0_[kL0Size];
+    Timer* ln_[kLevels][kLnSize];
+    uint64_t bitmap_[kL0Size / 64];
+    Timer* near_;       //已经转到当前tick，还没到精确到期时间
+    Timer* expired_;
+};
+
+
+}//namespace timer
+}//namespace duck